@@ -3,6 +3,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <setjmp.h>
+
+#ifndef DEBUG
+#define DEBUG 1
+#endif
+
+//When set, unimplemented instructions longjmp here instead of exiting
+_Thread_local jmp_buf *refFaultHandler;
 
 typedef struct ConditionCodes {
 	uint8_t		z:1;
@@ -345,8 +353,9 @@ void ArithFlagsA(State8080 *state, uint16_t res)
 void UnimplementedInstruction(State8080* state)
 {
 	//pc will have advanced one, so undo that
-	printf ("Error: Unimplemented instruction\n");
 	state->pc--;
+	if (refFaultHandler != NULL) longjmp(*refFaultHandler, 1);
+	printf ("Error: Unimplemented instruction\n");
 	Disassemble8080Op(state->memory, state->pc);
 	printf("\n");
 	exit(1);
@@ -357,7 +366,7 @@ int Emulate8080Op(State8080* state)
 	int cycles = 4;
 	unsigned char *opcode = &state->memory[state->pc];
 
-	Disassemble8080Op(state->memory, state->pc);
+	if (DEBUG) Disassemble8080Op(state->memory, state->pc);
 	
 	state->pc+=1;	
 	
@@ -865,6 +874,7 @@ int Emulate8080Op(State8080* state)
 			break;
 		case 0xff: UnimplementedInstruction(state); break;
 	}
+	if (!DEBUG) return 0;
 	printf("\t");
 	printf("%c", state->cc.z ? 'z' : '.');
 	printf("%c", state->cc.s ? 's' : '.');
@@ -0,0 +1,264 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "globals.h"
+#include "util.h"
+
+//Exhaustive ALU check: every 8-bit ALU opcode is run through emulateOp
+//for the whole of its input space (A x operand x CY x AC) and compared
+//with a bit-exact model of the 8080. The model is written with GCC
+//vector extensions and evaluates 8 operands per statement.
+
+void emulateOp(state8080*);
+
+typedef uint16_t lanes __attribute__((vector_size(16)));
+#define LANES 8
+
+//flag bits in the packed result, same order as cpuSnapshot plus AC
+#define FZ 0x01
+#define FS 0x02
+#define FP 0x04
+#define FCY 0x08
+#define FAC 0x10
+
+typedef enum {
+	M_ADD, M_ADC, M_SUB, M_SBB, M_ANA, M_XRA, M_ORA, M_CMP,
+	M_INR, M_DCR, M_DAA, M_RLC, M_RRC, M_RAL, M_RAR, M_CMA, M_STC, M_CMC
+} model_kind;
+
+typedef struct aluOp {
+	const char *name;
+	uint8_t opcode;
+	model_kind model;
+	uint8_t immediate; //operand is opcode[1] rather than B
+	uint8_t unary; //operates on A alone
+} aluOp;
+
+static const aluOp ops[] = {
+	{"ADD B", 0x80, M_ADD, 0, 0}, {"ADC B", 0x88, M_ADC, 0, 0},
+	{"SUB B", 0x90, M_SUB, 0, 0}, {"SBB B", 0x98, M_SBB, 0, 0},
+	{"ANA B", 0xa0, M_ANA, 0, 0}, {"XRA B", 0xa8, M_XRA, 0, 0},
+	{"ORA B", 0xb0, M_ORA, 0, 0}, {"CMP B", 0xb8, M_CMP, 0, 0},
+	{"ADI", 0xc6, M_ADD, 1, 0}, {"ACI", 0xce, M_ADC, 1, 0},
+	{"SUI", 0xd6, M_SUB, 1, 0}, {"SBI", 0xde, M_SBB, 1, 0},
+	{"ANI", 0xe6, M_ANA, 1, 0}, {"XRI", 0xee, M_XRA, 1, 0},
+	{"ORI", 0xf6, M_ORA, 1, 0}, {"CPI", 0xfe, M_CMP, 1, 0},
+	{"INR A", 0x3c, M_INR, 0, 1}, {"DCR A", 0x3d, M_DCR, 0, 1},
+	{"DAA", 0x27, M_DAA, 0, 1},
+	{"RLC", 0x07, M_RLC, 0, 1}, {"RRC", 0x0f, M_RRC, 0, 1},
+	{"RAL", 0x17, M_RAL, 0, 1}, {"RAR", 0x1f, M_RAR, 0, 1},
+	{"CMA", 0x2f, M_CMA, 0, 1}, {"STC", 0x37, M_STC, 0, 1},
+	{"CMC", 0x3f, M_CMC, 0, 1},
+};
+#define OP_COUNT (sizeof(ops) / sizeof(ops[0]))
+
+//Z, S and P going in; varied so "unaffected" is checked both ways
+static inline lanes zspIn(lanes a, lanes b) {
+	return (a ^ b ^ (a >> 3)) & 7;
+}
+
+static inline lanes flagsOf(lanes r) {
+	lanes x = r & 0xff;
+	lanes z = (lanes)(x == 0) & FZ;
+	lanes s = (x >> 6) & FS;
+	x ^= x >> 4;
+	x ^= x >> 2;
+	x ^= x >> 1;
+	lanes p = (~x & 1) << 2;
+	return z | s | p;
+}
+
+//Reference 8080: result in *res, packed flags in *flags
+static void reference(model_kind m, lanes a, lanes b, lanes cy, lanes ac, lanes *res, lanes *flags) {
+	lanes zsp = zspIn(a, b);
+	lanes r = a, f;
+	switch (m) {
+		case M_ADD: cy = cy & 0; //fall through
+		case M_ADC:
+			r = a + b + cy;
+			ac = ((a & 0xf) + (b & 0xf) + cy) >> 4;
+			cy = r >> 8;
+			f = flagsOf(r);
+			break;
+		case M_SUB: case M_CMP: cy = cy & 0; //fall through
+		case M_SBB: {
+			//a + ~b + !borrow, carry out inverted
+			lanes nb = ~b & 0xff;
+			lanes t = a + nb + (cy ^ 1);
+			ac = ((a & 0xf) + (nb & 0xf) + (cy ^ 1)) >> 4;
+			cy = (t >> 8) ^ 1;
+			r = m == M_CMP ? a : t;
+			f = flagsOf(t);
+			break;
+		}
+		case M_ANA:
+			r = a & b;
+			ac = ((a | b) >> 3) & 1;
+			cy = cy & 0;
+			f = flagsOf(r);
+			break;
+		case M_XRA: case M_ORA:
+			r = m == M_XRA ? a ^ b : a | b;
+			ac = ac & 0;
+			cy = cy & 0;
+			f = flagsOf(r);
+			break;
+		case M_INR:
+			r = a + 1;
+			ac = (lanes)((a & 0xf) == 0xf) & 1;
+			f = flagsOf(r);
+			break;
+		case M_DCR:
+			r = a - 1;
+			ac = (lanes)((a & 0xf) != 0) & 1;
+			f = flagsOf(r);
+			break;
+		case M_DAA: {
+			lanes lo = (lanes)(((a & 0xf) > 9) | (lanes)(ac != 0));
+			lanes hi = (lanes)((a > 0x99) | (lanes)(cy != 0));
+			lanes corr = (lo & 0x06) | (hi & 0x60);
+			r = a + corr;
+			ac = ((a & 0xf) + (corr & 0xf)) >> 4;
+			cy = hi & 1;
+			f = flagsOf(r);
+			break;
+		}
+		case M_RLC: r = (a << 1) | (a >> 7); cy = a >> 7; f = zsp; break;
+		case M_RRC: r = (a >> 1) | (a << 7); cy = a & 1; f = zsp; break;
+		case M_RAL: r = (a << 1) | cy; cy = a >> 7; f = zsp; break;
+		case M_RAR: r = (a >> 1) | (cy << 7); cy = a & 1; f = zsp; break;
+		case M_CMA: r = ~a; f = zsp; break;
+		case M_STC: cy = (cy & 0) | 1; f = zsp; break;
+		case M_CMC: cy = cy ^ 1; f = zsp; break;
+	}
+	*res = r & 0xff;
+	*flags = f | (cy & 1) << 3 | (ac & 1) << 4;
+}
+
+typedef struct opResult {
+	uint64_t cases;
+	uint64_t wrong[6]; //A, Z, S, P, CY, AC
+	uint8_t unimplemented;
+	uint8_t haveFirst;
+	uint8_t a, b, cy, ac, ourA, ourF, refA, refF;
+} opResult;
+
+static const char *columns[6] = {"A", "Z", "S", "P", "CY", "AC"};
+
+static void verifyOp(const aluOp *op, state8080 *state, opResult *out) {
+	uint8_t ourA[256], ourF[256];
+	jmp_buf fault;
+	if (setjmp(fault) != 0) {
+		faultHandler = NULL;
+		out->unimplemented = 1;
+		return;
+	}
+	faultHandler = &fault;
+	for (int cy = 0; cy < 2; cy++) {
+		for (int ac = 0; ac < 2; ac++) {
+			for (int a = 0; a < (op->unary ? 1 : 256); a++) {
+				for (int x = 0; x < 256; x++) {
+					uint8_t ra = op->unary ? x : a;
+					uint8_t rb = op->unary ? 0 : x;
+					lanes zsp = zspIn((lanes){ra}, (lanes){rb});
+					state->a = ra;
+					state->b = rb;
+					state->cc.z = zsp[0] & 1;
+					state->cc.s = (zsp[0] >> 1) & 1;
+					state->cc.p = (zsp[0] >> 2) & 1;
+					state->cc.cy = cy;
+					state->cc.ac = ac;
+					state->pc = 0;
+					state->memory[0] = op->opcode;
+					state->memory[1] = rb;
+					emulateOp(state);
+					ourA[x] = state->a;
+					ourF[x] = state->cc.z | state->cc.s << 1 | state->cc.p << 2 |
+						state->cc.cy << 3 | state->cc.ac << 4;
+				}
+				for (int x = 0; x < 256; x += LANES) {
+					lanes idx = {0, 1, 2, 3, 4, 5, 6, 7};
+					idx += (uint16_t)x;
+					lanes va = op->unary ? idx : (lanes){0} + (uint16_t)a;
+					lanes vb = op->unary ? (lanes){0} : idx;
+					lanes res, flags;
+					reference(op->model, va, vb, (lanes){0} + (uint16_t)cy, (lanes){0} + (uint16_t)ac, &res, &flags);
+					for (int i = 0; i < LANES; i++) {
+						uint8_t diff = (ourF[x + i] ^ flags[i]) & 0x1f;
+						uint8_t badA = ourA[x + i] != res[i];
+						out->cases++;
+						if (!diff && !badA) continue;
+						out->wrong[0] += badA;
+						for (int bit = 0; bit < 5; bit++) {
+							out->wrong[bit + 1] += (diff >> bit) & 1;
+						}
+						if (!out->haveFirst) {
+							out->haveFirst = 1;
+							out->a = va[i]; out->b = vb[i]; out->cy = cy; out->ac = ac;
+							out->ourA = ourA[x + i]; out->ourF = ourF[x + i];
+							out->refA = res[i]; out->refF = flags[i];
+						}
+					}
+				}
+			}
+		}
+	}
+	faultHandler = NULL;
+}
+
+static void printFlagBits(uint8_t f) {
+	printf("Z:%d S:%d P:%d CY:%d AC:%d", f & 1, (f >> 1) & 1, (f >> 2) & 1, (f >> 3) & 1, (f >> 4) & 1);
+}
+
+//usage: aluverify [-v]
+//-v prints the first failing input for every opcode
+int main(int argc, char **argv) {
+	int verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+	isTracing = 0;
+	state8080 state1 = {0};
+	state1.memory = calloc(1, 0x10000);
+	state1.memSize = 0x10000;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	opResult results[OP_COUNT];
+	memset(results, 0, sizeof(results));
+	for (size_t i = 0; i < OP_COUNT; i++) {
+		verifyOp(&ops[i], &state1, &results[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	uint64_t total = 0;
+	int failing = 0;
+	printf("%-6s %8s", "op", "cases");
+	for (int c = 0; c < 6; c++) printf(" %7s", columns[c]);
+	printf("\n");
+	for (size_t i = 0; i < OP_COUNT; i++) {
+		opResult *r = &results[i];
+		total += r->cases;
+		if (r->unimplemented) {
+			printf("%-6s unimplemented\n", ops[i].name);
+			continue;
+		}
+		printf("%-6s %8llu", ops[i].name, (unsigned long long)r->cases);
+		for (int c = 0; c < 6; c++) printf(" %7llu", (unsigned long long)r->wrong[c]);
+		printf("\n");
+		if (r->haveFirst) {
+			failing++;
+			if (verbose) {
+				printf("\tA:$%02x operand:$%02x CY:%d AC:%d -> emulateOp A:$%02x ", r->a, r->b, r->cy, r->ac, r->ourA);
+				printFlagBits(r->ourF);
+				printf(", 8080 A:$%02x ", r->refA);
+				printFlagBits(r->refF);
+				printf("\n");
+			}
+		}
+	}
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%llu cases in %.3fs, %d of %zu opcodes wrong\n",
+			(unsigned long long)total, secs, failing, OP_COUNT);
+	free(state1.memory);
+	return failing != 0;
+}
@@ -0,0 +1,257 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include "globals.h"
+#include "util.h"
+#include "cpm.h"
+#include "console.h"
+#include "stats.h"
+
+//Fixed benchmark corpus. Every workload runs as a CP/M program at 0x100
+//and ends with HLT or a warm boot.
+
+void emulateOp(state8080*);
+
+//alu: 10000 passes of mixed register arithmetic, logic and rotates
+static const uint8_t aluKernel[] = {
+	0x01, 0x10, 0x27,	//     LXI B,10000
+	0x3e, 0x00,			//     MVI A,0
+	0x80,				//loop ADD B
+	0x89,				//     ADC C
+	0x91,				//     SUB C
+	0x98,				//     SBB B
+	0xa8,				//     XRA B
+	0xb1,				//     ORA C
+	0xa1,				//     ANA C
+	0xb8,				//     CMP B
+	0xc6, 0x11,			//     ADI 11h
+	0x07,				//     RLC
+	0x1f,				//     RAR
+	0x3c,				//     INR A
+	0x0b,				//     DCX B
+	0x57,				//     MOV D,A
+	0x78,				//     MOV A,B
+	0xb1,				//     ORA C
+	0x7a,				//     MOV A,D
+	0xc2, 0x05, 0x01,	//     JNZ loop
+	0x76				//     HLT
+};
+
+//branch: 20000 passes through a diamond of conditional jumps
+static const uint8_t branchKernel[] = {
+	0x01, 0x20, 0x4e,	//      LXI B,20000
+	0x79,				//loop  MOV A,C
+	0xe6, 0x01,			//      ANI 1
+	0xca, 0x11, 0x01,	//      JZ even
+	0xfe, 0x01,			//      CPI 1
+	0xc2, 0x00, 0x00,	//      JNZ 0 (never)
+	0xc3, 0x14, 0x01,	//      JMP next
+	0xda, 0x00, 0x00,	//even  JC 0 (never)
+	0x0b,				//next  DCX B
+	0x78,				//      MOV A,B
+	0xb1,				//      ORA C
+	0xc2, 0x03, 0x01,	//      JNZ loop
+	0x76				//      HLT
+};
+
+//memcopy: 16 passes copying 4K from 1000h to 4000h
+static const uint8_t memcopyKernel[] = {
+	0x3e, 0x10,			//      MVI A,16
+	0x32, 0x00, 0x02,	//      STA 0200h
+	0x21, 0x00, 0x10,	//pass  LXI H,1000h
+	0x11, 0x00, 0x40,	//      LXI D,4000h
+	0x01, 0x00, 0x10,	//      LXI B,1000h
+	0x7e,				//copy  MOV A,M
+	0x12,				//      STAX D
+	0x23,				//      INX H
+	0x13,				//      INX D
+	0x0b,				//      DCX B
+	0x78,				//      MOV A,B
+	0xb1,				//      ORA C
+	0xc2, 0x0e, 0x01,	//      JNZ copy
+	0x3a, 0x00, 0x02,	//      LDA 0200h
+	0x3d,				//      DCR A
+	0x32, 0x00, 0x02,	//      STA 0200h
+	0xc2, 0x05, 0x01,	//      JNZ pass
+	0x76				//      HLT
+};
+
+//stack: 10000 passes of push/pop and two levels of call/ret
+static const uint8_t stackKernel[] = {
+	0x31, 0x00, 0xf0,	//      LXI SP,F000h
+	0x01, 0x10, 0x27,	//      LXI B,10000
+	0xc5,				//loop  PUSH B
+	0xd5,				//      PUSH D
+	0xe5,				//      PUSH H
+	0xcd, 0x16, 0x01,	//      CALL sub
+	0xe1,				//      POP H
+	0xd1,				//      POP D
+	0xc1,				//      POP B
+	0x0b,				//      DCX B
+	0x78,				//      MOV A,B
+	0xb1,				//      ORA C
+	0xc2, 0x06, 0x01,	//      JNZ loop
+	0x76,				//      HLT
+	0xf5,				//sub   PUSH PSW
+	0xcd, 0x1c, 0x01,	//      CALL sub2
+	0xf1,				//      POP PSW
+	0xc9,				//      RET
+	0xc5,				//sub2  PUSH B
+	0xc1,				//      POP B
+	0xc9				//      RET
+};
+
+typedef struct workload {
+	const char *name;
+	const uint8_t *code;
+	size_t size;
+} workload;
+
+typedef struct result {
+	uint64_t instrs;
+	uint64_t cycles;
+	double seconds;
+	uint8_t faulted;
+} result;
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//Counted before each instruction runs, the faulting one included. At
+//file scope they stay valid across the fault's longjmp without being
+//volatile, so the loop stores them only as often as the call to
+//emulateOp makes it.
+static uint64_t runInstrs, runCycles;
+
+static void runOnce(const workload *w, uint8_t *memory, result *res) {
+	state8080 state1 = {0};
+	state8080 *state = &state1;
+	memset(memory, 0, 0x10000);
+	memcpy(memory + CPM_TPA, w->code, w->size);
+	state->memory = memory;
+	state->memSize = 0x10000;
+	loadCpm(state);
+
+	jmp_buf fault;
+	runInstrs = runCycles = 0;
+	double start = now();
+	if (setjmp(fault) == 0) {
+		faultHandler = &fault;
+		uint64_t *counts = statCounters();
+		uint32_t prev = STATS_NO_PREV;
+		//two loops, so the plain one doesn't test for stats
+		if (counts != NULL) {
+			while (!state->halted) {
+				if (cpmTraps[state->pc]) {
+					cpmTrap(state);
+					continue;
+				}
+				uint8_t op = memory[state->pc];
+				COUNT_OP(counts, prev, op);
+				runInstrs++;
+				runCycles += opCycles[op];
+				emulateOp(state);
+			}
+		} else {
+			while (!state->halted) {
+				if (cpmTraps[state->pc]) {
+					cpmTrap(state);
+					continue;
+				}
+				uint8_t op = memory[state->pc];
+				runInstrs++;
+				runCycles += opCycles[op];
+				emulateOp(state);
+			}
+		}
+	} else {
+		res->faulted = 1;
+	}
+	res->seconds += now() - start;
+	res->instrs += runInstrs;
+	res->cycles += runCycles;
+	faultHandler = NULL;
+}
+
+static workload loadRom(const char *path) {
+	workload w = {path, NULL, 0};
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		printf("Error: Couldn't open %s\n", path);
+		exit(1);
+	}
+	fseek(f, 0L, SEEK_END);
+	long fsize = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	if (fsize > 0x10000 - CPM_TPA) fsize = 0x10000 - CPM_TPA;
+	uint8_t *code = malloc(fsize);
+	w.size = fread(code, 1, fsize, f);
+	w.code = code;
+	fclose(f);
+	return w;
+}
+
+//usage: bench [-n runs] [-o output] [--stats file] [cpudiag.bin]
+//--stats measures the run with opcode counting switched on
+int main(int argc, char **argv) {
+	int runs = 5;
+	const char *outPath = "bench_output.txt";
+	const char *cpudiag = "test.bin";
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			runs = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			outPath = argv[++i];
+		} else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+			startStats(argv[++i]);
+		} else {
+			cpudiag = argv[i];
+		}
+	}
+
+	workload corpus[] = {
+		loadRom(cpudiag),
+		{"alu", aluKernel, sizeof(aluKernel)},
+		{"branch", branchKernel, sizeof(branchKernel)},
+		{"memcopy", memcopyKernel, sizeof(memcopyKernel)},
+		{"stack", stackKernel, sizeof(stackKernel)},
+	};
+	corpus[0].name = "cpudiag";
+
+	isTracing = 0;
+	initConsole(open("/dev/null", O_WRONLY));
+	FILE *out = fopen(outPath, "w");
+	if (out == NULL) {
+		printf("Error: Couldn't open %s\n", outPath);
+		exit(1);
+	}
+	uint8_t *memory = malloc(0x10000);
+	const char *header = "workload,runs,instructions,cycles,seconds,mips,ns_per_instr,cycles_per_sec,status\n";
+	fputs(header, out);
+	fputs(header, stdout);
+	for (size_t w = 0; w < sizeof(corpus) / sizeof(corpus[0]); w++) {
+		result res = {0};
+		for (int r = 0; r < runs; r++) {
+			runOnce(&corpus[w], memory, &res);
+		}
+		double mips = res.seconds > 0 ? res.instrs / res.seconds / 1e6 : 0;
+		double nsPerInstr = res.instrs ? res.seconds * 1e9 / res.instrs : 0;
+		double cyclesPerSec = res.seconds > 0 ? res.cycles / res.seconds : 0;
+		for (int f = 0; f < 2; f++) {
+			fprintf(f ? stdout : out, "%s,%d,%llu,%llu,%.6f,%.2f,%.2f,%.0f,%s\n",
+					corpus[w].name, runs, (unsigned long long)res.instrs / runs,
+					(unsigned long long)res.cycles / runs, res.seconds, mips, nsPerInstr,
+					cyclesPerSec, res.faulted ? "fault" : "ok");
+		}
+	}
+	fclose(out);
+	free(memory);
+	stopStats();
+	return 0;
+}
@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "profile.h"
+#include "callgraph.h"
+
+//Guest call-graph profiler. call(), rst() and ret() keep a shadow call
+//stack; each frame remembers the SP its return address was pushed at,
+//so guest code that abandons frames (SPHL, popping return addresses,
+//jumping out through a pushed address) is unwound by comparing SPs
+//instead of trusting CALL/RET to pair up. Cycles are charged to the
+//top frame's node in a calling-context tree, which is what the
+//collapsed-stack output is written from.
+uint8_t callGraphOn;
+
+#define MAX_DEPTH 4096
+#define MAX_NODES 65536
+#define NODE_HASH (MAX_NODES * 2)
+#define TOP_FUNCTIONS 20
+
+typedef struct frame {
+	uint16_t entry;
+	uint32_t sp; //where the return address lives; 0x10000 for the root
+	int32_t node;
+	uint64_t start;
+} frame;
+
+typedef struct cctNode {
+	uint16_t entry;
+	int32_t parent;
+	uint64_t self;
+} cctNode;
+
+static frame frames[MAX_DEPTH];
+static int depth;
+static cctNode nodes[MAX_NODES];
+static int32_t nodeCount;
+static int32_t nodeHash[NODE_HASH];
+static uint64_t now;
+static const char *outPath;
+
+static uint64_t calls[0x10000];
+static uint64_t inclusive[0x10000];
+static uint64_t exclusive[0x10000];
+static uint16_t active[0x10000]; //activations on the stack, for recursion
+
+static int32_t childNode(int32_t parent, uint16_t entry) {
+	uint32_t h = ((uint32_t)parent * 0x9e3779b1u ^ entry) % NODE_HASH;
+	while (nodeHash[h] >= 0) {
+		cctNode *n = &nodes[nodeHash[h]];
+		if (n->parent == parent && n->entry == entry) return nodeHash[h];
+		h = (h + 1) % NODE_HASH;
+	}
+	if (nodeCount == MAX_NODES) return parent; //tree full: charge the caller
+	nodes[nodeCount] = (cctNode){entry, parent, 0};
+	nodeHash[h] = nodeCount;
+	return nodeCount++;
+}
+
+static void popFrame(void) {
+	frame *f = &frames[depth - 1];
+	if (--active[f->entry] == 0) inclusive[f->entry] += now - f->start;
+	depth--;
+}
+
+void callGraphEnter(state8080 *state) {
+	//frames at or below the new return address have been overwritten
+	while (depth > 1 && frames[depth - 1].sp <= state->sp) popFrame();
+	if (depth == MAX_DEPTH) return;
+	frame *f = &frames[depth++];
+	f->entry = state->pc;
+	f->sp = state->sp;
+	f->node = childNode(frames[depth - 2].node, state->pc);
+	f->start = now;
+	calls[f->entry]++;
+	active[f->entry]++;
+}
+
+void callGraphLeave(state8080 *state) {
+	while (depth > 1 && frames[depth - 1].sp < state->sp) popFrame();
+	if (depth > 1 && frames[depth - 1].sp == state->sp) popFrame();
+}
+
+void callGraphOp(uint8_t cycles) {
+	frame *f = &frames[depth - 1];
+	now += cycles;
+	exclusive[f->entry] += cycles;
+	nodes[f->node].self += cycles;
+}
+
+int startCallGraph(state8080 *state, const char *path) {
+	outPath = path;
+	memset(nodeHash, -1, sizeof(nodeHash));
+	nodes[0] = (cctNode){state->pc, -1, 0};
+	nodeCount = 1;
+	frames[0] = (frame){state->pc, 0x10000, 0, 0};
+	depth = 1;
+	calls[state->pc]++;
+	active[state->pc]++;
+	callGraphOn = 1;
+	return 0;
+}
+
+static int byInclusive(const void *a, const void *b) {
+	uint64_t x = inclusive[*(const uint16_t *)a], y = inclusive[*(const uint16_t *)b];
+	return (x < y) - (x > y);
+}
+
+//One line per calling context: "outer;inner;leaf cycles"
+static void writeCollapsed(FILE *out) {
+	int32_t path[MAX_DEPTH];
+	char name[64];
+	for (int32_t n = 0; n < nodeCount; n++) {
+		if (nodes[n].self == 0) continue;
+		int len = 0;
+		for (int32_t p = n; p >= 0 && len < MAX_DEPTH; p = nodes[p].parent) path[len++] = p;
+		for (int i = len - 1; i >= 0; i--) {
+			functionName(nodes[path[i]].entry, name, sizeof(name));
+			fprintf(out, "%s%s", name, i ? ";" : " ");
+		}
+		fprintf(out, "%llu\n", (unsigned long long)nodes[n].self);
+	}
+}
+
+void stopCallGraph(void) {
+	if (!callGraphOn) return;
+	callGraphOn = 0;
+	while (depth > 0) popFrame();
+
+	FILE *out = fopen(outPath, "w");
+	if (out == NULL) {
+		fprintf(stderr, "callgraph: couldn't write %s\n", outPath);
+	} else {
+		writeCollapsed(out);
+		fclose(out);
+	}
+
+	uint16_t *order = malloc(0x10000 * sizeof(uint16_t));
+	int n = 0;
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		if (calls[pc]) order[n++] = pc;
+	}
+	qsort(order, n, sizeof(uint16_t), byInclusive);
+	char name[64];
+	fprintf(stderr, "callgraph: %d call paths written to %s\n", nodeCount, outPath);
+	fprintf(stderr, "%10s %14s %14s  %s\n", "calls", "inclusive", "exclusive", "function");
+	for (int i = 0; i < n && i < TOP_FUNCTIONS; i++) {
+		functionName(order[i], name, sizeof(name));
+		fprintf(stderr, "%10llu %14llu %14llu  %s\n", (unsigned long long)calls[order[i]],
+				(unsigned long long)inclusive[order[i]], (unsigned long long)exclusive[order[i]], name);
+	}
+	free(order);
+}
@@ -0,0 +1,7 @@
+extern uint8_t callGraphOn;
+
+int startCallGraph(state8080*, const char*);
+void callGraphEnter(state8080*);
+void callGraphLeave(state8080*);
+void callGraphOp(uint8_t);
+void stopCallGraph(void);
@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "globals.h"
+#include "capture.h"
+
+//Frames go from the cpu thread to the writer thread through a
+//single-producer/single-consumer ring of preallocated buffers. The cpu
+//thread never waits: if the ring is full the frame is dropped.
+#define CAPTURE_SLOTS 32
+#define CAPTURE_BUFSIZE (4 << 20)
+
+static uint8_t *slots;
+static _Atomic uint32_t head; //next slot the cpu thread fills
+static _Atomic uint32_t tail; //next slot the writer drains
+static _Atomic int done;
+
+static FILE *out;
+static char *outBuf;
+static capture_kind kind;
+static pthread_t writer;
+static uint64_t framesDropped;
+static uint64_t framesWritten;
+
+static void writeFrame(uint8_t *frame, uint8_t *rgb) {
+	if (kind == CAPTURE_Y4M) {
+		fputs("FRAME\n", out);
+		fwrite(frame, FRAME_SIZE, 1, out);
+	} else {
+		for (int i = 0; i < FRAME_SIZE; i++) {
+			rgb[i * 3] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = frame[i];
+		}
+		fprintf(out, "P6\n%d %d\n255\n", FRAME_WIDTH, FRAME_HEIGHT);
+		fwrite(rgb, FRAME_SIZE * 3, 1, out);
+	}
+}
+
+static void *writerMain(void *arg) {
+	uint8_t *rgb = malloc(FRAME_SIZE * 3);
+	struct timespec idle = {0, 2000000};
+	for (;;) {
+		uint32_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+		if (t == atomic_load_explicit(&head, memory_order_acquire)) {
+			if (atomic_load_explicit(&done, memory_order_acquire)
+					&& t == atomic_load_explicit(&head, memory_order_acquire)) {
+				break;
+			}
+			nanosleep(&idle, NULL);
+			continue;
+		}
+		writeFrame(&slots[(t % CAPTURE_SLOTS) * FRAME_SIZE], rgb);
+		framesWritten++;
+		atomic_store_explicit(&tail, t + 1, memory_order_release);
+	}
+	free(rgb);
+	return NULL;
+}
+
+int startCapture(const char *path, capture_kind k) {
+	out = fopen(path, "wb");
+	if (out == NULL) {
+		printf("Error: Couldn't open %s\n", path);
+		return 1;
+	}
+	outBuf = malloc(CAPTURE_BUFSIZE);
+	setvbuf(out, outBuf, _IOFBF, CAPTURE_BUFSIZE);
+	slots = calloc(CAPTURE_SLOTS, FRAME_SIZE);
+	kind = k;
+	if (kind == CAPTURE_Y4M) {
+		fprintf(out, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 Cmono\n", FRAME_WIDTH, FRAME_HEIGHT);
+	}
+	pthread_create(&writer, NULL, writerMain, NULL);
+	return 0;
+}
+
+//Render video RAM into the next free slot. The screen is rotated 90
+//degrees counter-clockwise, so each 32 byte column of vram is one
+//column of output pixels, bottom to top.
+void captureFrame(state8080 *state) {
+	if (out == NULL) return;
+	uint32_t h = atomic_load_explicit(&head, memory_order_relaxed);
+	if (h - atomic_load_explicit(&tail, memory_order_acquire) == CAPTURE_SLOTS) {
+		framesDropped++;
+		return;
+	}
+	uint8_t *frame = &slots[(h % CAPTURE_SLOTS) * FRAME_SIZE];
+	uint8_t *vram = &state->memory[VRAM_START];
+	for (int x = 0; x < FRAME_WIDTH; x++) {
+		for (int i = 0; i < 32; i++) {
+			uint8_t bits = vram[x * 32 + i];
+			for (int b = 0; b < 8; b++) {
+				int y = FRAME_HEIGHT - 1 - (i * 8 + b);
+				frame[y * FRAME_WIDTH + x] = (bits >> b) & 1 ? 0xff : 0x00;
+			}
+		}
+	}
+	atomic_store_explicit(&head, h + 1, memory_order_release);
+}
+
+void stopCapture(void) {
+	if (out == NULL) return;
+	atomic_store_explicit(&done, 1, memory_order_release);
+	pthread_join(writer, NULL);
+	fclose(out);
+	out = NULL;
+	free(outBuf);
+	free(slots);
+	fprintf(stderr, "capture: %llu frames written, %llu dropped\n",
+			(unsigned long long)framesWritten, (unsigned long long)framesDropped);
+}
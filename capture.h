@@ -0,0 +1,14 @@
+//Space Invaders video RAM, 1bpp, 224 columns of 256 pixels
+#define VRAM_START 0x2400
+#define VRAM_SIZE 0x1c00
+
+//rotated screen as seen by the player
+#define FRAME_WIDTH 224
+#define FRAME_HEIGHT 256
+#define FRAME_SIZE (FRAME_WIDTH * FRAME_HEIGHT)
+
+typedef enum {CAPTURE_PPM, CAPTURE_Y4M} capture_kind;
+
+int startCapture(const char*, capture_kind);
+void captureFrame(state8080*);
+void stopCapture(void);
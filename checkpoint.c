@@ -0,0 +1,410 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "ports.h"
+#include "cpm.h"
+#include "memaccess.h"
+#include "debugger.h"
+#include "callgraph.h"
+#include "checkpoint.h"
+
+void emulateOp(state8080*);
+
+//Reverse execution. History is cut into segments, each opened by a
+//checkpoint: registers and ports at its first step, plus the old
+//contents of every page first written during it, saved by a page
+//handler just before the write lands. Putting back the saved pages of
+//every segment from the newest down to k leaves memory as it was when
+//k began, so going back means restoring the nearest checkpoint and
+//replaying forward. Replay is deterministic apart from the CP/M traps,
+//which talk to the host: the registers and bytes a trap changed are
+//logged the first time it runs and applied from the log afterwards,
+//so a replayed BDOS call neither prints nor reads again. A trap only
+//writes its FCB and dma buffer, so only those are compared.
+//
+//The checkpoint table has a fixed size. When it fills, neighbouring
+//segments merge (a page saved by both keeps the older copy) and the
+//interval doubles; when the saved pages and trap log outgrow the
+//budget, the oldest segments are dropped.
+//
+//Conditional breakpoints' hit counts go back with the checkpoint and
+//replay counts hits again, so a condition on hit_count sees the value
+//it had when the step first ran.
+uint8_t checkpointsOn;
+
+#define MAX_CHECKPOINTS 64
+#define FIRST_INTERVAL 4096 //steps
+#define SPAN_HEADER 3 //address, low first, then length
+
+typedef struct checkpoint {
+	uint64_t step;
+	state8080 regs;
+	portState ports;
+	hitCounts hits;
+	uint8_t *pages[256]; //contents at step of pages written since, NULL if untouched
+} checkpoint;
+
+typedef struct trapRecord {
+	uint64_t step;
+	state8080 regs; //after the trap
+	size_t offset; //into trapPool, spans of changed bytes
+	uint8_t spanCount;
+} trapRecord;
+
+static checkpoint checkpoints[MAX_CHECKPOINTS];
+static int checkpointCount;
+static uint64_t interval = FIRST_INTERVAL;
+static uint64_t step; //run loop iterations, traps included
+static uint64_t historyEnd; //furthest step reached; steps before it replay
+static trapRecord *traps;
+static size_t trapCount, trapCap;
+static uint8_t *trapPool;
+static size_t poolUsed, poolCap;
+static size_t savedBytes;
+static size_t budget;
+static uint16_t regionStart[CPM_TRAP_REGIONS], regionLen[CPM_TRAP_REGIONS];
+static uint8_t beforeTrap[CPM_TRAP_REGIONS][CPM_TRAP_REGION_MAX];
+static uint32_t memSize;
+
+static uint32_t pageBytes(int page) {
+	uint32_t left = memSize - (page << 8);
+	return left < 256 ? left : 256;
+}
+
+static void savePage(checkpoint *cp, int page, const uint8_t *memory) {
+	if (cp->pages[page] != NULL || (uint32_t)(page << 8) >= memSize) return;
+	cp->pages[page] = malloc(256);
+	memcpy(cp->pages[page], memory + (page << 8), pageBytes(page));
+	savedBytes += 256;
+}
+
+static void freePages(checkpoint *cp) {
+	for (int page = 0; page < 256; page++) {
+		if (cp->pages[page] == NULL) continue;
+		free(cp->pages[page]);
+		cp->pages[page] = NULL;
+		savedBytes -= 256;
+	}
+}
+
+static void onAccess(state8080 *state, uint16_t addr, uint8_t write) {
+	if (write && step >= historyEnd) {
+		savePage(&checkpoints[checkpointCount - 1], addr >> 8, state->memory);
+	}
+}
+
+//Registers only; the memory pointer and size stay
+static void setRegisters(state8080 *state, const state8080 *regs) {
+	uint8_t *memory = state->memory;
+	*state = *regs;
+	state->memory = memory;
+	state->memSize = memSize;
+}
+
+//Last checkpoint at or before s
+static int checkpointOf(uint64_t s) {
+	int k = checkpointCount - 1;
+	while (k > 0 && checkpoints[k].step > s) k--;
+	return k;
+}
+
+//First trap record at or after s
+static size_t trapFrom(uint64_t s) {
+	size_t lo = 0, hi = trapCount;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (traps[mid].step < s) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static void dropTrapsFrom(size_t i) {
+	if (i >= trapCount) return;
+	savedBytes -= (trapCount - i) * sizeof(trapRecord) + (poolUsed - traps[i].offset);
+	poolUsed = traps[i].offset;
+	trapCount = i;
+}
+
+static void dropOldest(void) {
+	freePages(&checkpoints[0]);
+	memmove(checkpoints, checkpoints + 1, --checkpointCount * sizeof(checkpoint));
+	size_t n = trapFrom(checkpoints[0].step);
+	if (n == 0) return;
+	size_t bytes = n < trapCount ? traps[n].offset : poolUsed;
+	memmove(trapPool, trapPool + bytes, poolUsed - bytes);
+	poolUsed -= bytes;
+	memmove(traps, traps + n, (trapCount - n) * sizeof(trapRecord));
+	trapCount -= n;
+	for (size_t i = 0; i < trapCount; i++) traps[i].offset -= bytes;
+	savedBytes -= n * sizeof(trapRecord) + bytes;
+}
+
+//Halves the table: each odd segment folds into the one before it
+static void thin(void) {
+	int n = 0;
+	for (int i = 0; i < checkpointCount; i += 2, n++) {
+		checkpoints[n] = checkpoints[i];
+		if (i + 1 == checkpointCount) break;
+		checkpoint *later = &checkpoints[i + 1];
+		for (int page = 0; page < 256; page++) {
+			if (later->pages[page] == NULL) continue;
+			if (checkpoints[n].pages[page] == NULL) {
+				checkpoints[n].pages[page] = later->pages[page];
+			} else {
+				free(later->pages[page]);
+				savedBytes -= 256;
+			}
+		}
+	}
+	checkpointCount = n;
+	interval *= 2;
+}
+
+static void takeCheckpoint(state8080 *state) {
+	if (checkpointCount == MAX_CHECKPOINTS) thin();
+	checkpoint *cp = &checkpoints[checkpointCount++];
+	memset(cp->pages, 0, sizeof(cp->pages));
+	cp->step = step;
+	cp->regs = *state;
+	savePorts(&cp->ports);
+	saveHits(&cp->hits);
+	while (savedBytes > budget && checkpointCount > 1) dropOldest();
+}
+
+static void restoreCheckpoint(state8080 *state, int k) {
+	for (int i = checkpointCount - 1; i >= k; i--) {
+		for (int page = 0; page < 256; page++) {
+			uint8_t *saved = checkpoints[i].pages[page];
+			if (saved != NULL) memcpy(state->memory + (page << 8), saved, pageBytes(page));
+		}
+	}
+	setRegisters(state, &checkpoints[k].regs);
+	restorePorts(&checkpoints[k].ports);
+	restoreHits(&checkpoints[k].hits);
+	step = checkpoints[k].step;
+}
+
+int startCheckpoints(state8080 *state, uint32_t budgetMb) {
+	int id = addPageHandler(onAccess);
+	if (id < 0) {
+		printf("Error: no page handler left for checkpoints\n");
+		return 1;
+	}
+	for (int page = 0; page < 256; page++) watchPage(id, page, 1);
+	memSize = state->memSize;
+	budget = (size_t)budgetMb << 20;
+	takeCheckpoint(state);
+	checkpointsOn = 1;
+	return 0;
+}
+
+void stopCheckpoints(void) {
+	if (!checkpointsOn) return;
+	checkpointsOn = 0;
+	while (checkpointCount > 0) freePages(&checkpoints[--checkpointCount]);
+	free(traps);
+	free(trapPool);
+}
+
+//Once per run loop iteration, after the instruction or trap
+void checkpointStep(state8080 *state) {
+	if (++step <= historyEnd) return;
+	historyEnd = step;
+	if (step - checkpoints[checkpointCount - 1].step >= interval) takeCheckpoint(state);
+}
+
+static void reserve(size_t bytes) {
+	while (poolUsed + bytes > poolCap) {
+		poolCap = poolCap ? poolCap * 2 : 64 * 1024;
+		trapPool = realloc(trapPool, poolCap);
+	}
+}
+
+static void putSpan(state8080 *state, const uint8_t *p) {
+	uint16_t at = p[0] | (p[1] << 8);
+	for (int i = 0; i < p[2]; i++) state->memory[(uint16_t)(at + i)] = p[SPAN_HEADER + i];
+}
+
+//Each region's changed bytes, first to last, go in as one span. The
+//undo pages must hold memory from before the trap, so the old bytes
+//are put back while they are saved.
+static void logTrap(state8080 *state) {
+	if (trapCount == trapCap) {
+		trapCap = trapCap ? trapCap * 2 : 64;
+		traps = realloc(traps, trapCap * sizeof(trapRecord));
+	}
+	trapRecord *rec = &traps[trapCount++];
+	rec->step = step;
+	rec->regs = *state;
+	rec->offset = poolUsed;
+	rec->spanCount = 0;
+	int spanRegion[CPM_TRAP_REGIONS], spanFirst[CPM_TRAP_REGIONS];
+	for (int r = 0; r < CPM_TRAP_REGIONS; r++) {
+		int first = -1, last = -1;
+		for (int i = 0; i < regionLen[r]; i++) {
+			uint16_t a = regionStart[r] + i;
+			if (a >= memSize || state->memory[a] == beforeTrap[r][i]) continue;
+			if (first < 0) first = i;
+			last = i;
+		}
+		if (first < 0) continue;
+		uint16_t at = regionStart[r] + first;
+		int len = last - first + 1;
+		reserve(SPAN_HEADER + len);
+		uint8_t *p = trapPool + poolUsed;
+		p[0] = at & 0xff;
+		p[1] = at >> 8;
+		p[2] = len;
+		for (int i = 0; i < len; i++) p[SPAN_HEADER + i] = state->memory[(uint16_t)(at + i)];
+		poolUsed += SPAN_HEADER + len;
+		spanRegion[rec->spanCount] = r;
+		spanFirst[rec->spanCount++] = first;
+	}
+	const uint8_t *p = trapPool + rec->offset;
+	for (int n = 0; n < rec->spanCount; n++, p += SPAN_HEADER + p[2]) {
+		uint16_t at = p[0] | (p[1] << 8);
+		const uint8_t *old = &beforeTrap[spanRegion[n]][spanFirst[n]];
+		for (int i = 0; i < p[2]; i++) state->memory[(uint16_t)(at + i)] = old[i];
+	}
+	p = trapPool + rec->offset;
+	for (int n = 0; n < rec->spanCount; n++, p += SPAN_HEADER + p[2]) {
+		uint16_t at = p[0] | (p[1] << 8);
+		savePage(&checkpoints[checkpointCount - 1], at >> 8, state->memory);
+		savePage(&checkpoints[checkpointCount - 1], (uint16_t)(at + p[2] - 1) >> 8, state->memory);
+	}
+	p = trapPool + rec->offset;
+	for (int n = 0; n < rec->spanCount; n++, p += SPAN_HEADER + p[2]) putSpan(state, p);
+	savedBytes += sizeof(trapRecord) + (poolUsed - rec->offset);
+}
+
+//Stands in for cpmTrap: live and logged the first time, from the log after
+void checkpointTrap(state8080 *state) {
+	size_t i = trapFrom(step);
+	if (step < historyEnd && i < trapCount && traps[i].step == step) {
+		const uint8_t *p = trapPool + traps[i].offset;
+		for (int n = 0; n < traps[i].spanCount; n++, p += SPAN_HEADER + p[2]) putSpan(state, p);
+		setRegisters(state, &traps[i].regs);
+	} else {
+		cpmTrapRegions(state, regionStart, regionLen);
+		for (int r = 0; r < CPM_TRAP_REGIONS; r++) {
+			for (int i = 0; i < regionLen[r]; i++) {
+				uint16_t a = regionStart[r] + i;
+				beforeTrap[r][i] = a < memSize ? state->memory[a] : 0;
+			}
+		}
+		cpmTrap(state);
+		if (step >= historyEnd) logTrap(state);
+	}
+	checkpointStep(state);
+}
+
+//The debugger changed registers or memory: what was recorded past the
+//current step no longer follows from it
+void checkpointDiverged(void) {
+	if (!checkpointsOn) return;
+	int k = checkpointOf(step);
+	while (checkpointCount - 1 > k) freePages(&checkpoints[--checkpointCount]);
+	dropTrapsFrom(trapFrom(step));
+	historyEnd = step;
+}
+
+//Before the debugger writes guest memory, so going back undoes it too
+void checkpointPoke(state8080 *state, uint32_t addr, uint32_t len) {
+	if (!checkpointsOn) return;
+	checkpointDiverged();
+	for (uint32_t a = addr; a < addr + len && a < memSize; a = (a | 0xff) + 1) {
+		savePage(&checkpoints[checkpointCount - 1], a >> 8, state->memory);
+	}
+}
+
+//One step of replay; returns 1 if it hit a watchpoint
+static int replayOne(state8080 *state) {
+	if (cpmTraps[state->pc]) {
+		checkpointTrap(state);
+		return 0;
+	}
+	if (pageHandlersOn) runPageHandlers(state);
+	emulateOp(state);
+	checkpointStep(state);
+	return takeWatchHit();
+}
+
+static void replayTo(state8080 *state, uint64_t target) {
+	while (step < target && !state->halted) {
+		breakpointAt(state); //only for the hit counts
+		replayOne(state);
+	}
+}
+
+//Replay doesn't feed the call graph or trace
+static uint8_t savedCalls, savedTracing;
+
+static void pauseHooks(void) {
+	savedCalls = callGraphOn;
+	savedTracing = isTracing;
+	callGraphOn = isTracing = 0;
+	takeWatchHit();
+}
+
+static void resumeHooks(void) {
+	callGraphOn = savedCalls;
+	isTracing = savedTracing;
+}
+
+//Back n steps; returns 1 if history ran out first
+int reverseStep(state8080 *state, uint32_t n) {
+	if (!checkpointsOn) return 1;
+	uint64_t target = step > n ? step - n : 0;
+	int ranOut = target < checkpoints[0].step;
+	if (ranOut) target = checkpoints[0].step;
+	pauseHooks();
+	restoreCheckpoint(state, checkpointOf(target));
+	replayTo(state, target);
+	resumeHooks();
+	setLastStop((stopInfo){STOP_STEP, state->pc, 0});
+	return ranOut;
+}
+
+//Back to the latest breakpoint or watchpoint hit before now, scanning
+//one segment at a time from the newest. Returns 1 and stops at the
+//start of history if there is none.
+int reverseContinue(state8080 *state) {
+	if (!checkpointsOn) return 1;
+	uint64_t now = step;
+	pauseHooks();
+	for (int k = checkpointOf(now > 0 ? now - 1 : 0); now > checkpoints[0].step && k >= 0; k--) {
+		uint64_t limit = k + 1 < checkpointCount && checkpoints[k + 1].step < now ? checkpoints[k + 1].step : now;
+		uint64_t found = 0;
+		stopInfo stop = {STOP_NONE, 0, 0};
+		restoreCheckpoint(state, k);
+		while (step < limit && !state->halted) {
+			if (breakpointAt(state)) {
+				found = step;
+				stop = (stopInfo){STOP_BREAK, state->pc, 0};
+			}
+			if (replayOne(state) && step < now) {
+				found = step;
+				stop = lastStopInfo();
+			}
+		}
+		if (stop.kind != STOP_NONE) {
+			restoreCheckpoint(state, k);
+			replayTo(state, found);
+			//a live stop here would have counted this hit too
+			if (stop.kind == STOP_BREAK) breakpointAt(state);
+			resumeHooks();
+			setLastStop(stop);
+			return 0;
+		}
+	}
+	restoreCheckpoint(state, 0);
+	resumeHooks();
+	setLastStop((stopInfo){STOP_STEP, state->pc, 0});
+	return 1;
+}
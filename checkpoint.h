@@ -0,0 +1,10 @@
+extern uint8_t checkpointsOn;
+
+int startCheckpoints(state8080*, uint32_t);
+void stopCheckpoints(void);
+void checkpointStep(state8080*);
+void checkpointTrap(state8080*);
+void checkpointDiverged(void);
+void checkpointPoke(state8080*, uint32_t, uint32_t);
+int reverseStep(state8080*, uint32_t);
+int reverseContinue(state8080*);
@@ -0,0 +1,256 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "globals.h"
+#include "condition.h"
+
+//Breakpoint conditions, C-like: `A == 0x3c && mem[HL] > 5`,
+//`hit_count % 1000 == 0`. The text is parsed once, by precedence
+//climbing, into postfix code for a small stack machine; a hit only
+//walks that array. Values are 32-bit signed, wrapping on overflow;
+//the machine works in uint32_t so none of it is undefined, and only
+//the compares, / % and >> look at the sign. Registers are A-L, the
+//pairs BC DE HL SP PC, the flags Z S P CY, mem[x] is the byte at x
+//and hit_count counts the times execution reached the breakpoint.
+#define MAX_COND_OPS 64
+#define COND_STACK 16
+
+typedef enum {
+	OP_CONST, OP_REG, OP_HITS, OP_MEM,
+	OP_NEG, OP_NOT, OP_INV,
+	OP_MUL, OP_DIV, OP_MOD, OP_ADD, OP_SUB, OP_SHL, OP_SHR,
+	OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+	OP_AND, OP_XOR, OP_OR, OP_LAND, OP_LOR
+} cond_op;
+
+typedef enum {
+	R_A, R_B, R_C, R_D, R_E, R_H, R_L, R_BC, R_DE, R_HL, R_SP, R_PC, R_Z, R_S, R_P, R_CY
+} cond_reg;
+
+static const char *regNames[] = {
+	"a", "b", "c", "d", "e", "h", "l", "bc", "de", "hl", "sp", "pc", "z", "s", "p", "cy"
+};
+
+typedef struct condOp {
+	uint8_t op;
+	int32_t arg;
+} condOp;
+
+struct condition {
+	int count;
+	condOp code[MAX_COND_OPS];
+};
+
+//two-character operators first, so "<=" isn't read as "<"
+static const struct {
+	const char *text;
+	uint8_t prec;
+	cond_op op;
+} binOps[] = {
+	{"||", 1, OP_LOR}, {"&&", 2, OP_LAND}, {"==", 6, OP_EQ}, {"!=", 6, OP_NE},
+	{"<=", 7, OP_LE}, {">=", 7, OP_GE}, {"<<", 8, OP_SHL}, {">>", 8, OP_SHR},
+	{"|", 3, OP_OR}, {"^", 4, OP_XOR}, {"&", 5, OP_AND}, {"<", 7, OP_LT}, {">", 7, OP_GT},
+	{"+", 9, OP_ADD}, {"-", 9, OP_SUB}, {"*", 10, OP_MUL}, {"/", 10, OP_DIV}, {"%", 10, OP_MOD},
+};
+
+typedef struct parser {
+	const char *p;
+	condition *cond;
+	int depth;
+	const char *err;
+} parser;
+
+static void emit(parser *ps, cond_op op, int32_t arg) {
+	if (ps->err) return;
+	if (ps->cond->count == MAX_COND_OPS) {
+		ps->err = "condition too long";
+		return;
+	}
+	if (op <= OP_HITS) {
+		ps->depth++;
+	} else if (op >= OP_MUL) {
+		ps->depth--;
+	}
+	if (ps->depth > COND_STACK) {
+		ps->err = "condition nests too deep";
+		return;
+	}
+	ps->cond->code[ps->cond->count++] = (condOp){op, arg};
+}
+
+static void skipSpace(parser *ps) {
+	while (isspace((unsigned char)*ps->p)) ps->p++;
+}
+
+static int accept(parser *ps, const char *text) {
+	skipSpace(ps);
+	size_t n = strlen(text);
+	if (strncmp(ps->p, text, n) != 0) return 0;
+	ps->p += n;
+	return 1;
+}
+
+static void parseExpr(parser *ps, int minPrec);
+
+static void parsePrimary(parser *ps) {
+	skipSpace(ps);
+	if (ps->err) return;
+	if (accept(ps, "(")) {
+		parseExpr(ps, 1);
+		if (!accept(ps, ")")) ps->err = "missing )";
+	} else if (accept(ps, "-")) {
+		parsePrimary(ps);
+		emit(ps, OP_NEG, 0);
+	} else if (accept(ps, "!")) {
+		parsePrimary(ps);
+		emit(ps, OP_NOT, 0);
+	} else if (accept(ps, "~")) {
+		parsePrimary(ps);
+		emit(ps, OP_INV, 0);
+	} else if (isdigit((unsigned char)*ps->p) || *ps->p == '$') {
+		int hex = *ps->p == '$';
+		char *end;
+		long v = strtol(ps->p + hex, &end, hex ? 16 : 0);
+		ps->p = end;
+		emit(ps, OP_CONST, v);
+	} else if (isalpha((unsigned char)*ps->p) || *ps->p == '_') {
+		char name[16];
+		int n = 0;
+		while ((isalnum((unsigned char)*ps->p) || *ps->p == '_') && n < (int)sizeof(name) - 1) {
+			name[n++] = tolower((unsigned char)*ps->p++);
+		}
+		name[n] = '\0';
+		if (strcmp(name, "mem") == 0) {
+			if (!accept(ps, "[")) {
+				ps->err = "expected mem[";
+				return;
+			}
+			parseExpr(ps, 1);
+			if (!accept(ps, "]")) ps->err = "missing ]";
+			emit(ps, OP_MEM, 0);
+			return;
+		}
+		if (strcmp(name, "hit_count") == 0) {
+			emit(ps, OP_HITS, 0);
+			return;
+		}
+		for (int r = 0; r <= R_CY; r++) {
+			if (strcmp(name, regNames[r]) == 0) {
+				emit(ps, OP_REG, r);
+				return;
+			}
+		}
+		ps->err = "unknown name";
+	} else {
+		ps->err = "expected a value";
+	}
+}
+
+static void parseExpr(parser *ps, int minPrec) {
+	parsePrimary(ps);
+	while (!ps->err) {
+		skipSpace(ps);
+		int i, found = -1;
+		for (i = 0; i < (int)(sizeof(binOps) / sizeof(binOps[0])); i++) {
+			if (strncmp(ps->p, binOps[i].text, strlen(binOps[i].text)) == 0) {
+				found = i;
+				break;
+			}
+		}
+		if (found < 0 || binOps[found].prec < minPrec) return;
+		ps->p += strlen(binOps[found].text);
+		parseExpr(ps, binOps[found].prec + 1);
+		emit(ps, binOps[found].op, 0);
+	}
+}
+
+//NULL on a syntax error, with the reason and where in err
+condition *compileCondition(const char *text, char *err, size_t errSize) {
+	condition *cond = calloc(1, sizeof(condition));
+	parser ps = {text, cond, 0, NULL};
+	parseExpr(&ps, 1);
+	skipSpace(&ps);
+	if (!ps.err && *ps.p) ps.err = "unexpected text";
+	if (ps.err) {
+		snprintf(err, errSize, "%s at \"%.16s\"", ps.err, ps.p);
+		free(cond);
+		return NULL;
+	}
+	return cond;
+}
+
+void freeCondition(condition *cond) {
+	free(cond);
+}
+
+static int32_t readReg(state8080 *state, int r) {
+	switch (r) {
+		case R_A: return state->a;
+		case R_B: return state->b;
+		case R_C: return state->c;
+		case R_D: return state->d;
+		case R_E: return state->e;
+		case R_H: return state->h;
+		case R_L: return state->l;
+		case R_BC: return (state->b << 8) | state->c;
+		case R_DE: return (state->d << 8) | state->e;
+		case R_HL: return (state->h << 8) | state->l;
+		case R_SP: return state->sp;
+		case R_PC: return state->pc;
+		case R_Z: return state->cc.z;
+		case R_S: return state->cc.s;
+		case R_P: return state->cc.p;
+		default: return state->cc.cy;
+	}
+}
+
+static uint32_t divide(uint32_t a, uint32_t b, int mod) {
+	if (b == 0) return 0;
+	//INT_MIN / -1 traps; x / -1 is -x and x % -1 is 0
+	if ((int32_t)b == -1) return mod ? 0 : 0u - a;
+	return mod ? (uint32_t)((int32_t)a % (int32_t)b) : (uint32_t)((int32_t)a / (int32_t)b);
+}
+
+int32_t evalCondition(const condition *cond, state8080 *state, uint64_t hits) {
+	uint32_t stack[COND_STACK];
+	int sp = 0;
+	for (int i = 0; i < cond->count; i++) {
+		uint32_t arg = cond->code[i].arg;
+		uint32_t b = sp > 0 ? stack[sp - 1] : 0;
+		uint32_t *a = sp > 1 ? &stack[sp - 2] : NULL;
+		switch (cond->code[i].op) {
+			case OP_CONST: stack[sp++] = arg; break;
+			case OP_REG: stack[sp++] = readReg(state, arg); break;
+			case OP_HITS: stack[sp++] = (uint32_t)hits; break;
+			case OP_MEM: stack[sp - 1] = (b & 0xffff) < state->memSize ? state->memory[b & 0xffff] : 0; break;
+			case OP_NEG: stack[sp - 1] = 0u - b; break;
+			case OP_NOT: stack[sp - 1] = !b; break;
+			case OP_INV: stack[sp - 1] = ~b; break;
+			default:
+				sp--;
+				switch (cond->code[i].op) {
+					case OP_MUL: *a *= b; break;
+					case OP_DIV: *a = divide(*a, b, 0); break;
+					case OP_MOD: *a = divide(*a, b, 1); break;
+					case OP_ADD: *a += b; break;
+					case OP_SUB: *a -= b; break;
+					case OP_SHL: *a <<= b & 31; break;
+					case OP_SHR: *a = (uint32_t)((int32_t)*a >> (b & 31)); break;
+					case OP_LT: *a = (int32_t)*a < (int32_t)b; break;
+					case OP_LE: *a = (int32_t)*a <= (int32_t)b; break;
+					case OP_GT: *a = (int32_t)*a > (int32_t)b; break;
+					case OP_GE: *a = (int32_t)*a >= (int32_t)b; break;
+					case OP_EQ: *a = *a == b; break;
+					case OP_NE: *a = *a != b; break;
+					case OP_AND: *a &= b; break;
+					case OP_XOR: *a ^= b; break;
+					case OP_OR: *a |= b; break;
+					case OP_LAND: *a = *a && b; break;
+					default: *a = *a || b; break;
+				}
+		}
+	}
+	return (int32_t)stack[0];
+}
@@ -0,0 +1,5 @@
+typedef struct condition condition;
+
+condition *compileCondition(const char*, char*, size_t);
+void freeCondition(condition*);
+int32_t evalCondition(const condition*, state8080*, uint64_t);
@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "console.h"
+
+//Guest console output collects here. On a terminal it is flushed at
+//each newline so output stays interactive; otherwise only when the
+//buffer fills or at exit. In raw mode it bypasses stdio and goes
+//straight to a file descriptor.
+#define CONSOLE_BUFSIZE (64 << 10)
+
+static uint8_t buf[CONSOLE_BUFSIZE];
+static size_t used;
+static int rawFd = -1;
+static uint8_t lineMode;
+
+//rawOut < 0 writes through stdout
+void initConsole(int rawOut) {
+	rawFd = rawOut;
+	lineMode = isatty(rawOut >= 0 ? rawOut : STDOUT_FILENO);
+}
+
+static void writeAll(const uint8_t *extra, size_t extraLen) {
+	if (rawFd >= 0) {
+		struct iovec iov[2] = {{buf, used}, {(void *)extra, extraLen}};
+		int n = extraLen ? 2 : 1;
+		int i = 0;
+		while (i < n) {
+			ssize_t w = writev(rawFd, iov + i, n - i);
+			if (w < 0) break;
+			while (i < n && (size_t)w >= iov[i].iov_len) {
+				w -= iov[i].iov_len;
+				i++;
+			}
+			if (i < n) {
+				iov[i].iov_base = (uint8_t *)iov[i].iov_base + w;
+				iov[i].iov_len -= w;
+			}
+		}
+	} else {
+		fwrite(buf, used, 1, stdout);
+		fwrite(extra, extraLen, 1, stdout);
+		fflush(stdout);
+	}
+	used = 0;
+}
+
+void flushConsole(void) {
+	if (used) writeAll(NULL, 0);
+}
+
+void consolePutc(uint8_t c) {
+	buf[used++] = c;
+	if (used == CONSOLE_BUFSIZE || (lineMode && c == '\n')) {
+		writeAll(NULL, 0);
+	}
+}
+
+//Strings too big for the buffer go out in the same write as it,
+//without being copied.
+void consoleWrite(const uint8_t *s, size_t len) {
+	if (lineMode && memchr(s, '\n', len)) {
+		writeAll(s, len);
+	} else if (used + len > CONSOLE_BUFSIZE) {
+		writeAll(s, len);
+	} else {
+		memcpy(buf + used, s, len);
+		used += len;
+	}
+}
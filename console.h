@@ -0,0 +1,4 @@
+void initConsole(int);
+void consolePutc(uint8_t);
+void consoleWrite(const uint8_t*, size_t);
+void flushConsole(void);
@@ -0,0 +1,107 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "util.h"
+#include "memaccess.h"
+#include "profile.h"
+#include "coverage.h"
+
+//Guest coverage: one bit per address for "an instruction started here",
+//"read" and "written". Setting a bit is an OR into an 8K array, so the
+//cost per instruction is the access decode plus a few stores.
+//
+//The dump is "I8080COV", a version byte, then the executed, read and
+//written bitmaps, 8K each, bit n of byte a>>3 being address a with n = a&7.
+static uint8_t executed[0x2000];
+static uint8_t readMap[0x2000];
+static uint8_t writtenMap[0x2000];
+static const char *dumpPath;
+static const char *listingPath;
+
+#define COVERAGE_VERSION 1
+
+#define SET(map, addr) ((map)[(addr) >> 3] |= 1 << ((addr) & 7))
+#define TEST(map, addr) (((map)[(addr) >> 3] >> ((addr) & 7)) & 1)
+
+void coverOp(state8080 *state) {
+	memAccess accesses[MAX_ACCESSES];
+	SET(executed, state->pc);
+	int n = decodeAccesses(state, accesses);
+	for (int i = 0; i < n; i++) {
+		if (accesses[i].write) {
+			SET(writtenMap, accesses[i].addr);
+		} else {
+			SET(readMap, accesses[i].addr);
+		}
+	}
+}
+
+int startCoverage(const char *path, const char *listing) {
+	dumpPath = path;
+	listingPath = listing;
+	return 0;
+}
+
+static int popcount(const uint8_t *map) {
+	int n = 0;
+	for (int i = 0; i < 0x2000; i++) n += __builtin_popcount(map[i]);
+	return n;
+}
+
+//Each line of the listing that starts with an address gets a column:
+//'x' executed, '-' not, then 'r'/'w' if data there was read/written.
+static void writeAnnotated(const char *outPath) {
+	FILE *in = fopen(listingPath, "r");
+	if (in == NULL) {
+		fprintf(stderr, "coverage: couldn't open listing %s\n", listingPath);
+		return;
+	}
+	FILE *out = fopen(outPath, "w");
+	if (out == NULL) {
+		fprintf(stderr, "coverage: couldn't write %s\n", outPath);
+		fclose(in);
+		return;
+	}
+	char line[256];
+	int lines = 0, hit = 0;
+	while (fgets(line, sizeof(line), in) != NULL) {
+		int addr = listingAddress(line);
+		if (addr < 0) {
+			fprintf(out, "    %s", line);
+			continue;
+		}
+		lines++;
+		hit += TEST(executed, addr);
+		fprintf(out, "%c%c%c %s", TEST(executed, addr) ? 'x' : '-',
+				TEST(readMap, addr) ? 'r' : ' ', TEST(writtenMap, addr) ? 'w' : ' ', line);
+	}
+	fclose(in);
+	fclose(out);
+	fprintf(stderr, "coverage: %d of %d listing lines executed, annotated listing in %s\n", hit, lines, outPath);
+}
+
+void stopCoverage(void) {
+	if (dumpPath == NULL) return;
+	FILE *f = fopen(dumpPath, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "coverage: couldn't write %s\n", dumpPath);
+	} else {
+		fwrite("I8080COV", 1, 8, f);
+		fputc(COVERAGE_VERSION, f);
+		fwrite(executed, 1, sizeof(executed), f);
+		fwrite(readMap, 1, sizeof(readMap), f);
+		fwrite(writtenMap, 1, sizeof(writtenMap), f);
+		fclose(f);
+		fprintf(stderr, "coverage: %d addresses executed, %d read, %d written, bitmaps in %s\n",
+				popcount(executed), popcount(readMap), popcount(writtenMap), dumpPath);
+	}
+	if (listingPath != NULL) {
+		char *outPath = malloc(strlen(dumpPath) + 5);
+		sprintf(outPath, "%s.lst", dumpPath);
+		writeAnnotated(outPath);
+		free(outPath);
+	}
+	dumpPath = NULL;
+}
@@ -0,0 +1,3 @@
+int startCoverage(const char*, const char*);
+void coverOp(state8080*);
+void stopCoverage(void);
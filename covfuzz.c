@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+#include "globals.h"
+#include "util.h"
+#include "ports.h"
+
+//Coverage-guided fuzzing entry point. Each input is a ROM fragment and
+//an input script:
+//
+//	u16 address, u16 length, fragment[length], then 3-byte records of
+//	{delay in 256-cycle units, port 1, port 2}
+//
+//The fragment is written over the template machine (an optional base
+//ROM from I8080_FUZZ_ROM) and run from $0000 for a bounded number of
+//cycles while the script drives the input ports. Guest coverage is
+//reported as AFL-style edges between consecutive PCs, hashed into a
+//64K bitmap: libFuzzer picks it up as extra counters, and under AFL the
+//bitmap is the shared memory segment named by __AFL_SHM_ID.
+
+void emulateOp(state8080*);
+
+#define MAP_SIZE 0x10000
+#define ROM_SIZE 0x2000
+#define FUZZ_CYCLES 500000
+#define SCRIPT_UNIT 256
+
+__attribute__((section("__libfuzzer_extra_counters")))
+static uint8_t extraCounters[MAP_SIZE];
+static uint8_t *coverage = extraCounters;
+
+static state8080 template;
+static uint8_t templateMemory[0x10000];
+static state8080 machine;
+//Stack and data addresses wrap in the core, but the operand bytes of
+//an instruction at $fffe or $ffff are read through a pointer past the
+//end, so they land in padding rather than the next static
+static uint8_t memory[0x10000 + 2];
+static uint64_t cycleBudget = FUZZ_CYCLES;
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+	isTracing = 0;
+	const char *shm = getenv("__AFL_SHM_ID");
+	if (shm != NULL) {
+		void *map = shmat(atoi(shm), NULL, 0);
+		if (map != (void *)-1) coverage = map;
+	}
+	const char *budget = getenv("I8080_FUZZ_CYCLES");
+	if (budget != NULL) cycleBudget = strtoull(budget, NULL, 0);
+	const char *rom = getenv("I8080_FUZZ_ROM");
+	if (rom != NULL) {
+		FILE *f = fopen(rom, "rb");
+		if (f == NULL) {
+			fprintf(stderr, "covfuzz: couldn't open %s\n", rom);
+			exit(1);
+		}
+		fread(templateMemory, 1, ROM_SIZE, f);
+		fclose(f);
+	}
+	template.memory = templateMemory;
+	template.memSize = 0x10000;
+	template.sp = 0x2400;
+	return 0;
+}
+
+static uint16_t le16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (template.memory == NULL) LLVMFuzzerInitialize(NULL, NULL);
+	if (size < 4) return 0;
+	uint16_t addr = le16(data);
+	uint16_t len = le16(data + 2);
+	if (addr >= ROM_SIZE) return 0;
+	if (len > size - 4) len = size - 4;
+	if (len > ROM_SIZE - addr) len = ROM_SIZE - addr;
+	const uint8_t *script = data + 4 + len;
+	const uint8_t *scriptEnd = data + size;
+
+	//reset from the template
+	memcpy(memory, templateMemory, 0x10000);
+	memcpy(memory + addr, data + 4, len);
+	machine = template;
+	machine.memory = memory;
+	resetPorts();
+
+	uint64_t cycles = 0;
+	uint64_t nextEvent = 0;
+	uint16_t prev = 0;
+	jmp_buf fault;
+	if (setjmp(fault) != 0) {
+		faultHandler = NULL;
+		return 0;
+	}
+	faultHandler = &fault;
+	while (!machine.halted && cycles < cycleBudget) {
+		if (cycles >= nextEvent && script + 3 <= scriptEnd) {
+			nextEvent = cycles + (uint64_t)script[0] * SCRIPT_UNIT;
+			setInputPort(1, script[1]);
+			setInputPort(2, script[2]);
+			script += 3;
+		}
+		uint16_t pc = machine.pc;
+		coverage[(pc ^ prev) & (MAP_SIZE - 1)]++;
+		prev = pc >> 1;
+		uint8_t op = memory[pc];
+		emulateOp(&machine);
+		cycles += opCycles[op];
+	}
+	faultHandler = NULL;
+	return 0;
+}
+
+#ifdef FUZZ_REPLAY
+//Without libFuzzer: run each file given and report the edges it hit
+int main(int argc, char **argv) {
+	LLVMFuzzerInitialize(&argc, &argv);
+	for (int i = 1; i < argc; i++) {
+		FILE *f = fopen(argv[i], "rb");
+		if (f == NULL) {
+			fprintf(stderr, "covfuzz: couldn't open %s\n", argv[i]);
+			continue;
+		}
+		fseek(f, 0, SEEK_END);
+		long size = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		uint8_t *data = malloc(size > 0 ? size : 1);
+		fread(data, 1, size, f);
+		fclose(f);
+		memset(coverage, 0, MAP_SIZE);
+		LLVMFuzzerTestOneInput(data, size);
+		int edges = 0;
+		for (int e = 0; e < MAP_SIZE; e++) edges += coverage[e] != 0;
+		printf("%s: %d edges, pc $%04x%s\n", argv[i], edges, machine.pc, machine.halted ? " (halted)" : "");
+		free(data);
+	}
+	return 0;
+}
+#endif
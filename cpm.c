@@ -0,0 +1,644 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "globals.h"
+#include "cpm.h"
+#include "console.h"
+#include "instrs/branching.h"
+#include "disk.h"
+
+//Traps are looked up by pc in a flat table, so the cost on untrapped
+//code is one byte load per instruction rather than an address compare
+//in every CALL.
+uint8_t cpmTraps[0x10000];
+static trap_handler trapHandlers[256];
+static int trapCount;
+
+#define MAX_FILES 16
+#define FCB_MAGIC 0xf7 //open on a host file, slot in fcb[17]
+#define FCB_DISK 0xf8 //open on a mounted drive, drive in fcb[17]
+#define RECORD_SIZE 128
+
+static int files[MAX_FILES];
+static uint16_t dma = 0x0080;
+static uint8_t curDrive;
+
+//BIOS disk state and the tables SELDSK hands back. These share the
+//page above the stack with the BDOS entry point, which is never run.
+#define DIRBUF (CPM_DISK_TABLES)
+#define DPB (CPM_DISK_TABLES + 0x80)
+#define DPH(drive) (CPM_DISK_TABLES + 0x90 + (drive) * 16)
+#define ALV(drive) (CPM_DISK_TABLES + 0x100 + (drive) * 32)
+#define CSV(drive) (CPM_DISK_TABLES + 0x180 + (drive) * 16)
+
+static const uint8_t dpb3740[15] = {
+	DISK_SPT, 0,	//SPT
+	3, 7, 0,		//BSH, BLM, EXM: 1K blocks
+	242, 0,			//DSM
+	63, 0,			//DRM
+	0xc0, 0x00,		//AL0, AL1
+	16, 0,			//CKS
+	2, 0			//OFF: two system tracks
+};
+
+//The BDOS reads and writes files on a mounted drive itself, through
+//the same layout: 1K blocks after the two system tracks, the first
+//two holding 64 directory entries, each mapping 16 blocks (one 128
+//record extent) of a file
+#define BLOCK_RECORDS 8
+#define DISK_BLOCKS 243
+#define DIR_BLOCKS 2
+#define DIR_ENTRIES 64
+#define EXTENT_RECORDS 128
+#define EMPTY 0xe5
+
+static uint8_t curDisk;
+static uint16_t curTrack;
+static uint16_t curSector;
+
+void setCpmTrap(uint16_t addr, trap_handler handler) {
+	if (cpmTraps[addr] == 0) {
+		cpmTraps[addr] = ++trapCount;
+	}
+	trapHandlers[cpmTraps[addr]] = handler;
+}
+
+void cpmTrap(state8080 *state) {
+	trapHandlers[cpmTraps[state->pc]](state);
+}
+
+//Leave a trapped routine the way its RET would have
+void cpmReturn(state8080 *state) {
+	ret(state);
+}
+
+static void setResult(state8080 *state, uint16_t val) {
+	state->a = state->l = val & 0xff;
+	state->b = state->h = val >> 8;
+}
+
+//Stops the run loop, which then shuts down normally
+static void warmBoot(state8080 *state) {
+	state->halted = 1;
+}
+
+//A name byte that can't leave the current directory: no separators,
+//no dots (so no ".."), nothing unprintable
+static int nameChar(uint8_t c) {
+	return c > ' ' && c < 0x7f && c != '/' && c != '\\' && c != '.';
+}
+
+//Host file name for the FCB at addr: "NAME    TXT" -> "name.txt".
+//Returns 1, leaving name empty, if the FCB doesn't hold a plain name.
+static int fcbName(state8080 *state, uint16_t addr, char *name) {
+	uint8_t *fcb = &state->memory[addr];
+	int n = 0;
+	name[0] = '\0';
+	for (int i = 1; i <= 8 && (fcb[i] & 0x7f) != ' '; i++) {
+		if (!nameChar(fcb[i] & 0x7f)) return 1;
+		name[n++] = tolower(fcb[i] & 0x7f);
+	}
+	if (n == 0) return 1;
+	if ((fcb[9] & 0x7f) != ' ') {
+		name[n++] = '.';
+		for (int i = 9; i <= 11 && (fcb[i] & 0x7f) != ' '; i++) {
+			if (!nameChar(fcb[i] & 0x7f)) return 1;
+			name[n++] = tolower(fcb[i] & 0x7f);
+		}
+	}
+	name[n] = '\0';
+	return 0;
+}
+
+//Open files are remembered in the FCB's allocation map, which a
+//transient program never looks at.
+static int fcbFile(state8080 *state, uint16_t addr) {
+	uint8_t *fcb = &state->memory[addr];
+	if (fcb[16] != FCB_MAGIC || fcb[17] >= MAX_FILES || files[fcb[17]] <= 0) {
+		return -1;
+	}
+	return files[fcb[17]];
+}
+
+static int openFcb(state8080 *state, uint16_t addr, int flags) {
+	char name[16];
+	if (fcbName(state, addr, name)) return 0xff;
+	int slot = 0;
+	while (slot < MAX_FILES && files[slot] > 0) slot++;
+	if (slot == MAX_FILES) return 0xff;
+	int fd = open(name, flags, 0644);
+	if (fd < 0) return 0xff;
+	files[slot] = fd;
+	uint8_t *fcb = &state->memory[addr];
+	fcb[12] = 0; //ex
+	fcb[14] = 0; //s2
+	fcb[16] = FCB_MAGIC;
+	fcb[17] = slot;
+	fcb[32] = 0; //cr
+	return 0;
+}
+
+static int closeFcb(state8080 *state, uint16_t addr) {
+	uint8_t *fcb = &state->memory[addr];
+	if (fcb[16] == FCB_DISK) {
+		fcb[16] = 0; //the directory was kept up to date as it went
+		return 0;
+	}
+	if (fcbFile(state, addr) < 0) return 0xff;
+	close(files[fcb[17]]);
+	files[fcb[17]] = 0;
+	fcb[16] = 0;
+	return 0;
+}
+
+static uint32_t seqRecord(uint8_t *fcb) {
+	return (fcb[14] * 32 + fcb[12]) * 128 + fcb[32];
+}
+
+static void setSeqRecord(uint8_t *fcb, uint32_t rec) {
+	fcb[32] = rec % 128;
+	fcb[12] = (rec / 128) % 32;
+	fcb[14] = rec / (128 * 32);
+}
+
+static uint32_t randRecord(uint8_t *fcb) {
+	return fcb[33] | (fcb[34] << 8) | (fcb[35] << 16);
+}
+
+//Files on a mounted drive. The directory and data are read and written
+//in place in the mapped image, so no record costs a syscall. Only user
+//0 is seen; a directory entry is the extent's name, EX and S2 (the
+//extent number, low five bits and the rest), RC (records used in it)
+//and one byte per block.
+
+//Mounted drive the FCB names (0 is the current one), or -1 for host files
+static int fcbDrive(const uint8_t *fcb) {
+	int drive = fcb[0] ? fcb[0] - 1 : curDrive;
+	return diskMounted(drive) ? drive : -1;
+}
+
+//Record rec of block, NULL if the image can't supply it
+static uint8_t *blockRecord(int drive, int block, int rec, int forWrite) {
+	int s = 2 * DISK_SPT + block * BLOCK_RECORDS + rec;
+	return diskSector(drive, s / DISK_SPT, s % DISK_SPT, forWrite);
+}
+
+static uint8_t *dirEntry(int drive, int i, int forWrite) {
+	uint8_t *sec = blockRecord(drive, 0, i / 4, forWrite);
+	return sec != NULL ? sec + (i % 4) * 32 : NULL;
+}
+
+static int sameName(const uint8_t *entry, const uint8_t *fcb) {
+	if (entry[0] != 0) return 0;
+	for (int i = 1; i <= 11; i++) {
+		if ((entry[i] & 0x7f) != (fcb[i] & 0x7f)) return 0;
+	}
+	return 1;
+}
+
+//Directory index of the file's extent ext, or -1
+static int findExtent(int drive, const uint8_t *fcb, int ext) {
+	for (int i = 0; i < DIR_ENTRIES; i++) {
+		uint8_t *entry = dirEntry(drive, i, 0);
+		if (entry != NULL && sameName(entry, fcb) && entry[12] == (ext & 0x1f) && entry[14] == ext >> 5) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+//An empty extent ext for the file, or -1 if the directory is full
+static int newExtent(int drive, const uint8_t *fcb, int ext) {
+	for (int i = 0; i < DIR_ENTRIES; i++) {
+		uint8_t *entry = dirEntry(drive, i, 1);
+		if (entry == NULL) return -1;
+		if (entry[0] != EMPTY) continue;
+		memset(entry, 0, 32);
+		for (int k = 1; k <= 11; k++) entry[k] = fcb[k] & 0x7f;
+		entry[12] = ext & 0x1f;
+		entry[14] = ext >> 5;
+		return i;
+	}
+	return -1;
+}
+
+//First block no extent uses, 0 if the disk is full
+static int allocBlock(int drive) {
+	uint8_t used[DISK_BLOCKS] = {0};
+	for (int i = 0; i < DIR_ENTRIES; i++) {
+		uint8_t *entry = dirEntry(drive, i, 0);
+		if (entry == NULL || entry[0] == EMPTY) continue;
+		for (int k = 16; k < 32; k++) {
+			if (entry[k] < DISK_BLOCKS) used[entry[k]] = 1;
+		}
+	}
+	for (int block = DIR_BLOCKS; block < DISK_BLOCKS; block++) {
+		if (!used[block]) return block;
+	}
+	return 0;
+}
+
+static int openDisk(state8080 *state, uint16_t addr, int drive) {
+	uint8_t *fcb = &state->memory[addr];
+	if (findExtent(drive, fcb, 0) < 0) return 0xff;
+	fcb[12] = 0; //ex
+	fcb[14] = 0; //s2
+	fcb[16] = FCB_DISK;
+	fcb[17] = drive;
+	fcb[32] = 0; //cr
+	return 0;
+}
+
+//Frees every extent of the file; 0xff if there were none
+static int deleteDisk(int drive, const uint8_t *fcb) {
+	int found = 0;
+	for (int i = 0; i < DIR_ENTRIES; i++) {
+		uint8_t *entry = dirEntry(drive, i, 1);
+		if (entry == NULL) return 0xff;
+		if (!sameName(entry, fcb)) continue;
+		entry[0] = EMPTY;
+		found = 1;
+	}
+	return found ? 0 : 0xff;
+}
+
+static int makeDisk(state8080 *state, uint16_t addr, int drive) {
+	uint8_t *fcb = &state->memory[addr];
+	deleteDisk(drive, fcb);
+	if (newExtent(drive, fcb, 0) < 0) return 0xff;
+	return openDisk(state, addr, drive);
+}
+
+//New name at FCB+16
+static int renameDisk(int drive, const uint8_t *fcb) {
+	int found = 0;
+	for (int i = 0; i < DIR_ENTRIES; i++) {
+		uint8_t *entry = dirEntry(drive, i, 1);
+		if (entry == NULL) return 0xff;
+		if (!sameName(entry, fcb)) continue;
+		for (int k = 1; k <= 11; k++) entry[k] = fcb[16 + k] & 0x7f;
+		found = 1;
+	}
+	return found ? 0 : 0xff;
+}
+
+static uint32_t diskRecords(int drive, const uint8_t *fcb) {
+	uint32_t recs = 0;
+	for (int i = 0; i < DIR_ENTRIES; i++) {
+		uint8_t *entry = dirEntry(drive, i, 0);
+		if (entry == NULL || !sameName(entry, fcb)) continue;
+		uint32_t end = (entry[14] * 32 + entry[12]) * EXTENT_RECORDS + entry[15];
+		if (end > recs) recs = end;
+	}
+	return recs;
+}
+
+static int readDisk(state8080 *state, uint8_t *fcb, uint32_t rec) {
+	int drive = fcb[17];
+	if (!diskMounted(drive)) return 9;
+	int i = findExtent(drive, fcb, rec / EXTENT_RECORDS);
+	if (i < 0) return 1;
+	uint8_t *entry = dirEntry(drive, i, 0);
+	int r = rec % EXTENT_RECORDS;
+	int block = entry[16 + r / BLOCK_RECORDS];
+	if (r >= entry[15] || block == 0) return 1; //end of file
+	uint8_t *sec = blockRecord(drive, block, r % BLOCK_RECORDS, 0);
+	if (sec == NULL) return 1;
+	for (int k = 0; k < RECORD_SIZE; k++) {
+		state->memory[(uint16_t)(dma + k)] = sec[k];
+	}
+	return 0;
+}
+
+//1 if the directory is full, 2 if the disk is, or is read-only
+static int writeDisk(state8080 *state, uint8_t *fcb, uint32_t rec) {
+	int drive = fcb[17];
+	if (!diskMounted(drive)) return 9;
+	int i = findExtent(drive, fcb, rec / EXTENT_RECORDS);
+	if (i < 0) i = newExtent(drive, fcb, rec / EXTENT_RECORDS);
+	if (i < 0) return 1;
+	uint8_t *entry = dirEntry(drive, i, 1);
+	if (entry == NULL) return 2;
+	int r = rec % EXTENT_RECORDS;
+	int slot = 16 + r / BLOCK_RECORDS;
+	if (entry[slot] == 0) {
+		entry[slot] = allocBlock(drive);
+		if (entry[slot] == 0) return 2;
+	}
+	uint8_t *sec = blockRecord(drive, entry[slot], r % BLOCK_RECORDS, 1);
+	if (sec == NULL) return 2;
+	for (int k = 0; k < RECORD_SIZE; k++) {
+		sec[k] = state->memory[(uint16_t)(dma + k)];
+	}
+	if (r >= entry[15]) entry[15] = r + 1;
+	return 0;
+}
+
+static int readRecord(state8080 *state, uint16_t addr, uint32_t rec) {
+	if (state->memory[addr + 16] == FCB_DISK) return readDisk(state, &state->memory[addr], rec);
+	int fd = fcbFile(state, addr);
+	if (fd < 0) return 9;
+	uint8_t buf[RECORD_SIZE];
+	ssize_t n = pread(fd, buf, RECORD_SIZE, (off_t)rec * RECORD_SIZE);
+	if (n <= 0) return 1; //end of file
+	memset(buf + n, 0x1a, RECORD_SIZE - n); //pad with ^Z like a real disk
+	for (int i = 0; i < RECORD_SIZE; i++) {
+		state->memory[(uint16_t)(dma + i)] = buf[i];
+	}
+	return 0;
+}
+
+static int writeRecord(state8080 *state, uint16_t addr, uint32_t rec) {
+	if (state->memory[addr + 16] == FCB_DISK) return writeDisk(state, &state->memory[addr], rec);
+	int fd = fcbFile(state, addr);
+	if (fd < 0) return 9;
+	uint8_t buf[RECORD_SIZE];
+	for (int i = 0; i < RECORD_SIZE; i++) {
+		buf[i] = state->memory[(uint16_t)(dma + i)];
+	}
+	if (pwrite(fd, buf, RECORD_SIZE, (off_t)rec * RECORD_SIZE) != RECORD_SIZE) return 2;
+	return 0;
+}
+
+static void bdos(state8080 *state) {
+	uint16_t de = (state->d << 8) | state->e;
+	uint8_t *fcb = &state->memory[de];
+	char name[16], newName[16];
+	int drive = fcbDrive(fcb);
+	uint16_t result = 0;
+	switch (state->c) {
+		case 0: //system reset
+			warmBoot(state);
+			break;
+		case 1: //console input
+			flushConsole();
+			result = getchar() & 0xff;
+			break;
+		case 2: //console output
+			consolePutc(state->e);
+			break;
+		case 6: //direct console i/o
+			if (state->e != 0xff) consolePutc(state->e);
+			break;
+		case 9: { //print string
+			uint8_t *end = memchr(fcb, '$', 0x10000 - de);
+			if (end != NULL) {
+				consoleWrite(fcb, end - fcb);
+			}
+			break;
+		}
+		case 11: //console status
+			break;
+		case 13: //reset disk system
+			curDrive = 0;
+			dma = 0x0080;
+			break;
+		case 14: //select disk
+			curDrive = state->e & 0x0f;
+			break;
+		case 25: //current disk
+			result = curDrive;
+			break;
+		case 12: //version
+			result = 0x0022;
+			break;
+		case 15: //open file
+			result = drive >= 0 ? openDisk(state, de, drive) : openFcb(state, de, O_RDWR);
+			break;
+		case 16: //close file
+			result = closeFcb(state, de);
+			break;
+		case 17: //search first
+		case 18: //search next
+			result = 0xff;
+			break;
+		case 19: //delete file
+			if (drive >= 0) {
+				result = deleteDisk(drive, fcb);
+			} else {
+				result = fcbName(state, de, name) || unlink(name) != 0 ? 0xff : 0;
+			}
+			break;
+		case 20: //read sequential
+			result = readRecord(state, de, seqRecord(fcb));
+			if (result == 0) setSeqRecord(fcb, seqRecord(fcb) + 1);
+			break;
+		case 21: //write sequential
+			result = writeRecord(state, de, seqRecord(fcb));
+			if (result == 0) setSeqRecord(fcb, seqRecord(fcb) + 1);
+			break;
+		case 22: //make file
+			if (drive >= 0) {
+				result = makeDisk(state, de, drive);
+			} else {
+				result = openFcb(state, de, O_RDWR | O_CREAT | O_TRUNC);
+			}
+			break;
+		case 23: //rename file, new name at FCB+16
+			if (drive >= 0) {
+				result = renameDisk(drive, fcb);
+			} else {
+				result = fcbName(state, de, name) || fcbName(state, de + 16, newName)
+						|| rename(name, newName) != 0 ? 0xff : 0;
+			}
+			break;
+		case 26: //set dma address
+			dma = de;
+			break;
+		case 33: //read random
+			result = readRecord(state, de, randRecord(fcb));
+			if (result == 0) setSeqRecord(fcb, randRecord(fcb));
+			break;
+		case 34: //write random
+			result = writeRecord(state, de, randRecord(fcb));
+			if (result == 0) setSeqRecord(fcb, randRecord(fcb));
+			break;
+		case 35: { //compute file size
+			int fd = fcbFile(state, de);
+			uint32_t recs = 0;
+			if (drive >= 0) {
+				recs = diskRecords(drive, fcb);
+			} else if (fd >= 0) {
+				recs = (lseek(fd, 0, SEEK_END) + RECORD_SIZE - 1) / RECORD_SIZE;
+			}
+			fcb[33] = recs;
+			fcb[34] = recs >> 8;
+			fcb[35] = recs >> 16;
+			break;
+		}
+		case 36: { //set random record
+			uint32_t rec = seqRecord(fcb);
+			fcb[33] = rec;
+			fcb[34] = rec >> 8;
+			fcb[35] = rec >> 16;
+			break;
+		}
+		default:
+			flushConsole();
+			printf("Error: Unimplemented BDOS function %d @ address $%04x\n", state->c,
+					state->memory[state->sp] | (state->memory[(uint16_t)(state->sp + 1)] << 8));
+			exit(1);
+	}
+	setResult(state, result);
+	cpmReturn(state);
+}
+
+static void put16(state8080 *state, uint16_t addr, uint16_t val) {
+	state->memory[addr] = val & 0xff;
+	state->memory[addr + 1] = val >> 8;
+}
+
+static void biosConst(state8080 *state) {
+	state->a = 0x00;
+	cpmReturn(state);
+}
+
+static void biosConin(state8080 *state) {
+	flushConsole();
+	state->a = getchar() & 0x7f;
+	cpmReturn(state);
+}
+
+static void biosConout(state8080 *state) {
+	consolePutc(state->c);
+	cpmReturn(state);
+}
+
+static void biosNull(state8080 *state) {
+	cpmReturn(state);
+}
+
+static void biosReader(state8080 *state) {
+	state->a = 0x1a;
+	cpmReturn(state);
+}
+
+static void biosListst(state8080 *state) {
+	state->a = 0xff;
+	cpmReturn(state);
+}
+
+static void biosHome(state8080 *state) {
+	curTrack = 0;
+	cpmReturn(state);
+}
+
+static void biosSeldsk(state8080 *state) {
+	uint16_t dph = 0;
+	if (diskMounted(state->c)) {
+		curDisk = state->c;
+		dph = DPH(curDisk);
+	}
+	state->h = dph >> 8;
+	state->l = dph & 0xff;
+	cpmReturn(state);
+}
+
+static void biosSettrk(state8080 *state) {
+	curTrack = (state->b << 8) | state->c;
+	cpmReturn(state);
+}
+
+static void biosSetsec(state8080 *state) {
+	curSector = (state->b << 8) | state->c;
+	cpmReturn(state);
+}
+
+//Where the trap about to run may write, taken from the registers it
+//starts with. Everything a BDOS or BIOS call stores lands in the FCB
+//at DE (a console call's DE just isn't an FCB) or the dma buffer.
+void cpmTrapRegions(state8080 *state, uint16_t *start, uint16_t *len) {
+	start[0] = (state->d << 8) | state->e;
+	len[0] = 36;
+	start[1] = dma;
+	len[1] = RECORD_SIZE;
+}
+
+static void biosSetdma(state8080 *state) {
+	dma = (state->b << 8) | state->c;
+	cpmReturn(state);
+}
+
+//Sector i/o is a copy between guest memory and the mapped image. A dma
+//buffer that wraps past 0xffff is copied in two pieces.
+static void biosRead(state8080 *state) {
+	uint8_t *sec = diskSector(curDisk, curTrack, curSector, 0);
+	state->a = 1;
+	if (sec != NULL) {
+		uint32_t first = 0x10000 - dma < SECTOR_SIZE ? 0x10000 - dma : SECTOR_SIZE;
+		memcpy(&state->memory[dma], sec, first);
+		memcpy(state->memory, sec + first, SECTOR_SIZE - first);
+		state->a = 0;
+	}
+	cpmReturn(state);
+}
+
+static void biosWrite(state8080 *state) {
+	uint8_t *sec = diskSector(curDisk, curTrack, curSector, 1);
+	state->a = 1;
+	if (sec != NULL) {
+		uint32_t first = 0x10000 - dma < SECTOR_SIZE ? 0x10000 - dma : SECTOR_SIZE;
+		memcpy(sec, &state->memory[dma], first);
+		memcpy(sec + first, state->memory, SECTOR_SIZE - first);
+		state->a = 0;
+	}
+	cpmReturn(state);
+}
+
+//No skew table, so logical and physical sectors are the same
+static void biosSectran(state8080 *state) {
+	state->h = state->b;
+	state->l = state->c;
+	cpmReturn(state);
+}
+
+static const trap_handler biosEntries[17] = {
+	warmBoot, warmBoot, biosConst, biosConin, biosConout,
+	biosNull, biosNull, biosReader, biosHome, biosSeldsk,
+	biosSettrk, biosSetsec, biosSetdma, biosRead, biosWrite,
+	biosListst, biosSectran
+};
+
+//BIOS jump table entries jump to themselves and are all trapped, so a
+//program calling through (0001h) lands in the handler.
+static void loadBios(state8080 *state) {
+	for (int i = 0; i < 17; i++) {
+		uint16_t entry = CPM_BIOS + i * 3;
+		state->memory[entry] = 0xc3;
+		put16(state, entry + 1, entry);
+		setCpmTrap(entry, biosEntries[i]);
+	}
+	memcpy(&state->memory[DPB], dpb3740, sizeof(dpb3740));
+	for (int drive = 0; drive < DISK_COUNT; drive++) {
+		uint16_t dph = DPH(drive);
+		memset(&state->memory[dph], 0, 16);
+		put16(state, dph + 8, DIRBUF);
+		put16(state, dph + 10, DPB);
+		put16(state, dph + 12, CSV(drive));
+		put16(state, dph + 14, ALV(drive));
+	}
+}
+
+//Page zero gets the usual jumps to warm boot and the BDOS, both of
+//which are trapped. The program starts at the TPA with a return
+//address of 0 on the stack, so a final RET warm boots.
+void loadCpm(state8080 *state) {
+	uint8_t *mem = state->memory;
+	mem[0x0000] = 0xc3;
+	mem[0x0001] = (CPM_BIOS + 3) & 0xff;
+	mem[0x0002] = (CPM_BIOS + 3) >> 8;
+	mem[0x0005] = 0xc3;
+	mem[0x0006] = CPM_BDOS & 0xff;
+	mem[0x0007] = CPM_BDOS >> 8;
+	loadBios(state);
+	setCpmTrap(0x0000, warmBoot);
+	setCpmTrap(0x0005, bdos);
+	state->sp = CPM_BDOS - 2;
+	mem[state->sp] = 0x00;
+	mem[state->sp + 1] = 0x00;
+	state->pc = CPM_TPA;
+}
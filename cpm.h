@@ -0,0 +1,20 @@
+//CP/M 2.2 memory map as seen by a transient program
+#define CPM_TPA 0x0100
+#define CPM_BDOS 0xfc00
+#define CPM_DISK_TABLES 0xfc00
+#define CPM_BIOS 0xff00
+
+typedef void (*trap_handler)(state8080*);
+
+//guest memory a trap may write: the FCB at DE and the dma buffer
+#define CPM_TRAP_REGIONS 2
+#define CPM_TRAP_REGION_MAX 128
+
+//nonzero entries index the handler trapped at that address
+extern uint8_t cpmTraps[0x10000];
+
+void loadCpm(state8080*);
+void setCpmTrap(uint16_t, trap_handler);
+void cpmTrap(state8080*);
+void cpmReturn(state8080*);
+void cpmTrapRegions(state8080*, uint16_t*, uint16_t*);
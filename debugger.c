@@ -0,0 +1,379 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "globals.h"
+#include "util.h"
+#include "disassembler.h"
+#include "memaccess.h"
+#include "condition.h"
+#include "debugger.h"
+#include "checkpoint.h"
+#include "trace.h"
+
+//Breakpoints and watchpoints. The run loop only calls in while
+//debugActive is set. Breakpoints are a bit per address, tested before
+//each instruction; a conditional one runs its compiled condition only
+//once the bit has matched. Watchpoints switch on a page handler for every page
+//their range touches, so only instructions that touch those pages
+//compare against the ranges; a hit stops after the instruction, with
+//the access done; the run loop dispatches page handlers itself, since
+//checkpoints use them too. Stops go to a handler, the console prompt
+//unless a remote debugger has taken over.
+_Atomic uint8_t debugActive;
+
+typedef struct condBreak {
+	uint16_t addr;
+	condition *cond;
+	uint64_t hits;
+} condBreak;
+
+static uint8_t breakMap[0x2000];
+static int breakCount;
+static condBreak conds[MAX_CONDITIONS];
+static int condCount;
+static watchpoint watches[MAX_WATCHES];
+static int watchCount;
+static int watchId = -1;
+static uint32_t stepsLeft;
+static _Atomic uint8_t stopRequested;
+static uint8_t skipping; //resuming from a breakpoint at skipPc
+static uint16_t skipPc;
+static uint8_t watchHit;
+static stopInfo lastStop;
+static stop_handler onStop = debugPrompt;
+
+#define BREAK_SET(addr) (breakMap[(addr) >> 3] & (1 << ((addr) & 7)))
+
+static void updateActive(void) {
+	debugActive = breakCount || watchCount || stepsLeft || stopRequested;
+	//requestStop may have run on another thread since the read above
+	if (stopRequested) debugActive = 1;
+}
+
+static void dropCondition(uint16_t addr) {
+	for (int i = 0; i < condCount; i++) {
+		if (conds[i].addr == addr) {
+			freeCondition(conds[i].cond);
+			conds[i] = conds[--condCount];
+			return;
+		}
+	}
+}
+
+int setBreakpoint(uint16_t addr) {
+	dropCondition(addr);
+	if (BREAK_SET(addr)) return 1;
+	breakMap[addr >> 3] |= 1 << (addr & 7);
+	breakCount++;
+	updateActive();
+	return 0;
+}
+
+//Takes ownership of cond
+int setConditionalBreakpoint(uint16_t addr, condition *cond) {
+	dropCondition(addr);
+	if (condCount == MAX_CONDITIONS) {
+		freeCondition(cond);
+		return 1;
+	}
+	conds[condCount++] = (condBreak){addr, cond, 0};
+	if (!BREAK_SET(addr)) {
+		breakMap[addr >> 3] |= 1 << (addr & 7);
+		breakCount++;
+		updateActive();
+	}
+	return 0;
+}
+
+int clearBreakpoint(uint16_t addr) {
+	dropCondition(addr);
+	if (!BREAK_SET(addr)) return 1;
+	breakMap[addr >> 3] &= ~(1 << (addr & 7));
+	breakCount--;
+	updateActive();
+	return 0;
+}
+
+static void onWatchedAccess(state8080 *state, uint16_t addr, uint8_t write) {
+	uint8_t kind = write ? WATCH_WRITE : WATCH_READ;
+	for (int i = 0; i < watchCount; i++) {
+		if (addr >= watches[i].start && addr <= watches[i].end && (watches[i].kind & kind)) {
+			watchHit = 1;
+			lastStop = (stopInfo){STOP_WATCH, addr, write};
+			return;
+		}
+	}
+}
+
+static void rewatchPages(void) {
+	for (int page = 0; page < 256; page++) {
+		uint8_t on = 0;
+		for (int i = 0; i < watchCount && !on; i++) {
+			on = page >= (watches[i].start >> 8) && page <= (watches[i].end >> 8);
+		}
+		watchPage(watchId, page, on);
+	}
+}
+
+int addWatchpoint(uint16_t start, uint16_t end, uint8_t kind) {
+	if (watchCount == MAX_WATCHES || end < start) return 1;
+	if (watchId < 0) watchId = addPageHandler(onWatchedAccess);
+	if (watchId < 0) return 1;
+	watches[watchCount++] = (watchpoint){start, end, kind};
+	rewatchPages();
+	updateActive();
+	return 0;
+}
+
+int removeWatchpoint(uint16_t start, uint16_t end, uint8_t kind) {
+	for (int i = 0; i < watchCount; i++) {
+		if (watches[i].start == start && watches[i].end == end && watches[i].kind == kind) {
+			watches[i] = watches[--watchCount];
+			rewatchPages();
+			updateActive();
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void debugStep(uint32_t n) {
+	stepsLeft = n;
+	updateActive();
+}
+
+void requestStop(void) {
+	stopRequested = 1;
+	debugActive = 1;
+}
+
+void setStopHandler(stop_handler handler) {
+	onStop = handler != NULL ? handler : debugPrompt;
+}
+
+stopInfo lastStopInfo(void) {
+	return lastStop;
+}
+
+void setLastStop(stopInfo stop) {
+	lastStop = stop;
+}
+
+//The bit has matched at pc: plain breakpoints always stop, conditional
+//ones when their condition holds
+static int breakTaken(state8080 *state) {
+	for (int i = 0; i < condCount; i++) {
+		if (conds[i].addr != state->pc) continue;
+		conds[i].hits++;
+		return evalCondition(conds[i].cond, state, conds[i].hits) != 0;
+	}
+	return 1;
+}
+
+//For replay, which counts hits as the live run did once the counts of
+//the checkpoint it starts from are back
+int breakpointAt(state8080 *state) {
+	return BREAK_SET(state->pc) && breakTaken(state);
+}
+
+void saveHits(hitCounts *saved) {
+	saved->count = condCount;
+	for (int i = 0; i < condCount; i++) {
+		saved->addr[i] = conds[i].addr;
+		saved->hits[i] = conds[i].hits;
+	}
+}
+
+//A condition set since the checkpoint had no hits yet then
+void restoreHits(const hitCounts *saved) {
+	for (int i = 0; i < condCount; i++) {
+		conds[i].hits = 0;
+		for (int j = 0; j < saved->count; j++) {
+			if (saved->addr[j] == conds[i].addr) conds[i].hits = saved->hits[j];
+		}
+	}
+}
+
+int takeWatchHit(void) {
+	int hit = watchHit;
+	watchHit = 0;
+	return hit;
+}
+
+int debugBefore(state8080 *state) {
+	if (stopRequested) {
+		stopRequested = 0;
+		updateActive();
+		lastStop = (stopInfo){STOP_REQUEST, state->pc, 0};
+		return 1;
+	}
+	if (skipping && state->pc == skipPc) {
+		skipping = 0;
+	} else if (BREAK_SET(state->pc) && breakTaken(state)) {
+		lastStop = (stopInfo){STOP_BREAK, state->pc, 0};
+		return 1;
+	}
+	skipping = 0;
+	if (stepsLeft) disassemble((char *)state->memory, state->pc); //what s runs
+	return 0;
+}
+
+int debugAfter(state8080 *state) {
+	if (takeWatchHit()) return 1;
+	if (stepsLeft && --stepsLeft == 0) {
+		updateActive();
+		lastStop = (stopInfo){STOP_STEP, state->pc, 0};
+		return 1;
+	}
+	return 0;
+}
+
+void debugStop(state8080 *state) {
+	onStop(state);
+	//a stop asked for while we were already stopped has been served
+	stopRequested = 0;
+	updateActive();
+	//don't stop again on the breakpoint we're leaving
+	skipping = 1;
+	skipPc = state->pc;
+	traceResync(state);
+}
+
+static int parseAddr(const char *s, uint16_t *out) {
+	if (s == NULL) return 1;
+	if (*s == '$') s++;
+	char *end;
+	unsigned long v = strtoul(s, &end, 16);
+	if (end == s || v > 0xffff) return 1;
+	*out = v;
+	return 0;
+}
+
+//"start[-end][:r|w|rw]"
+int parseWatch(const char *s, uint16_t *start, uint16_t *end, uint8_t *kind) {
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%s", s);
+	*kind = WATCH_WRITE;
+	char *colon = strchr(buf, ':');
+	if (colon != NULL) {
+		*colon = '\0';
+		*kind = (strchr(colon + 1, 'r') ? WATCH_READ : 0) | (strchr(colon + 1, 'w') ? WATCH_WRITE : 0);
+		if (*kind == 0) return 1;
+	}
+	char *dash = strchr(buf, '-');
+	if (dash != NULL) *dash = '\0';
+	if (parseAddr(buf, start)) return 1;
+	*end = *start;
+	return dash != NULL && parseAddr(dash + 1, end);
+}
+
+//"addr [if condition]"
+int parseBreakpoint(const char *spec, char *err, size_t errSize) {
+	uint16_t addr;
+	if (parseAddr(spec, &addr)) {
+		snprintf(err, errSize, "bad address");
+		return 1;
+	}
+	const char *rest = spec + strspn(spec, " \t$");
+	rest += strspn(rest, "0123456789abcdefABCDEFxX");
+	rest += strspn(rest, " \t");
+	if (*rest == '\0') {
+		setBreakpoint(addr);
+		return 0;
+	}
+	if (strncmp(rest, "if", 2) != 0 || !isspace((unsigned char)rest[2])) {
+		snprintf(err, errSize, "expected if");
+		return 1;
+	}
+	condition *cond = compileCondition(rest + 3, err, errSize);
+	if (cond == NULL) return 1;
+	if (setConditionalBreakpoint(addr, cond)) {
+		snprintf(err, errSize, "too many conditional breakpoints");
+		return 1;
+	}
+	return 0;
+}
+
+static void describeStop(state8080 *state) {
+	switch (lastStop.kind) {
+		case STOP_BREAK: printf("breakpoint at $%04x\n", lastStop.addr); break;
+		case STOP_WATCH:
+			printf("watchpoint: %s $%04x (now $%02x)\n", lastStop.write ? "write" : "read",
+					lastStop.addr, state->memory[lastStop.addr]);
+			break;
+		case STOP_REQUEST: printf("stopped at $%04x\n", state->pc); break;
+		default: break;
+	}
+	printf("PC:$%04x SP:$%04x A:$%02x B:$%02x C:$%02x D:$%02x E:$%02x H:$%02x L:$%02x",
+			state->pc, state->sp, state->a, state->b, state->c, state->d, state->e, state->h, state->l);
+	printFlags(state);
+	disassemble((char *)state->memory, state->pc);
+}
+
+static void dumpMemory(state8080 *state, uint16_t addr, int n) {
+	for (int i = 0; i < n; i += 16) {
+		printf("%04x:", (uint16_t)(addr + i));
+		for (int j = i; j < i + 16 && j < n; j++) printf(" %02x", state->memory[(uint16_t)(addr + j)]);
+		printf("\n");
+	}
+}
+
+//Console stop handler. Enter steps one instruction.
+void debugPrompt(state8080 *state) {
+	char line[128], raw[128];
+	char err[96];
+	describeStop(state);
+	for (;;) {
+		printf("(i8080) ");
+		fflush(stdout);
+		if (fgets(line, sizeof(line), stdin) == NULL) exit(0);
+		line[strcspn(line, "\r\n")] = '\0';
+		memcpy(raw, line, sizeof(raw));
+		char *cmd = strtok(line, " \t\r\n");
+		char *arg = strtok(NULL, " \t\r\n");
+		char *arg2 = strtok(NULL, " \t\r\n");
+		uint16_t addr, end;
+		uint8_t kind;
+		if (cmd == NULL || strcmp(cmd, "s") == 0) {
+			debugStep(arg != NULL ? strtoul(arg, NULL, 0) : 1);
+			return;
+		} else if (strcmp(cmd, "c") == 0) {
+			return;
+		} else if ((strcmp(cmd, "rs") == 0 || strcmp(cmd, "rc") == 0) && !checkpointsOn) {
+			printf("reverse execution needs -rev\n");
+		} else if (strcmp(cmd, "rs") == 0) {
+			if (reverseStep(state, arg != NULL ? strtoul(arg, NULL, 0) : 1)) printf("start of history\n");
+			describeStop(state);
+		} else if (strcmp(cmd, "rc") == 0) {
+			if (reverseContinue(state)) printf("start of history\n");
+			describeStop(state);
+		} else if (strcmp(cmd, "b") == 0 && arg != NULL) {
+			if (parseBreakpoint(raw + (arg - line), err, sizeof(err))) printf("%s\n", err);
+		} else if (strcmp(cmd, "d") == 0 && parseAddr(arg, &addr) == 0) {
+			if (clearBreakpoint(addr)) printf("no breakpoint at $%04x\n", addr);
+		} else if (strcmp(cmd, "w") == 0 && arg != NULL && parseWatch(arg, &addr, &end, &kind) == 0) {
+			if (addWatchpoint(addr, end, kind)) printf("couldn't add watchpoint\n");
+		} else if (strcmp(cmd, "dw") == 0 && arg != NULL && parseWatch(arg, &addr, &end, &kind) == 0) {
+			if (removeWatchpoint(addr, end, kind)) printf("no such watchpoint\n");
+		} else if (strcmp(cmd, "r") == 0) {
+			debugPrint(state);
+		} else if (strcmp(cmd, "x") == 0 && parseAddr(arg, &addr) == 0) {
+			dumpMemory(state, addr, arg2 != NULL ? strtoul(arg2, NULL, 0) : 64);
+		} else if (strcmp(cmd, "t") == 0) {
+			if (traceOn) {
+				flushTrace();
+			} else {
+				printf("no -trace file\n");
+			}
+		} else if (strcmp(cmd, "q") == 0) {
+			exit(0);
+		} else {
+			printf("s [n]  step (Enter steps one)\nc      continue\nrs [n] step back\nrc     continue back\n"
+					"b addr [if cond]  set breakpoint\nd addr  delete breakpoint\n"
+					"w/dw start[-end][:r|w|rw]  add/delete watchpoint (default :w)\n"
+					"r      registers\nx addr [n]  dump memory\nt      write the -trace ring now\nq      quit\n");
+		}
+	}
+}
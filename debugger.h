@@ -0,0 +1,50 @@
+typedef enum {STOP_NONE, STOP_BREAK, STOP_WATCH, STOP_STEP, STOP_REQUEST} stop_kind;
+
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+#define MAX_WATCHES 32
+#define MAX_CONDITIONS 32
+
+typedef struct watchpoint {
+	uint16_t start;
+	uint16_t end; //inclusive
+	uint8_t kind;
+} watchpoint;
+
+typedef struct stopInfo {
+	stop_kind kind;
+	uint16_t addr; //breakpoint or watched address
+	uint8_t write;
+} stopInfo;
+
+//hit_count of each conditional breakpoint, as of a checkpoint
+typedef struct hitCounts {
+	uint8_t count;
+	uint16_t addr[MAX_CONDITIONS];
+	uint64_t hits[MAX_CONDITIONS];
+} hitCounts;
+
+typedef void (*stop_handler)(state8080*);
+
+//set from the gdb stub's network thread too
+extern _Atomic uint8_t debugActive;
+
+int setBreakpoint(uint16_t);
+int clearBreakpoint(uint16_t);
+int parseBreakpoint(const char*, char*, size_t);
+int addWatchpoint(uint16_t, uint16_t, uint8_t);
+int removeWatchpoint(uint16_t, uint16_t, uint8_t);
+int parseWatch(const char*, uint16_t*, uint16_t*, uint8_t*);
+void debugStep(uint32_t);
+void requestStop(void);
+void setStopHandler(stop_handler);
+stopInfo lastStopInfo(void);
+void setLastStop(stopInfo);
+int breakpointAt(state8080*);
+void saveHits(hitCounts*);
+void restoreHits(const hitCounts*);
+int takeWatchHit(void);
+int debugBefore(state8080*);
+int debugAfter(state8080*);
+void debugStop(state8080*);
+void debugPrompt(state8080*);
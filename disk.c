@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "disk.h"
+
+//Each drive is a disk image mapped into our address space, so sector
+//i/o is a memcpy and the kernel does the paging. Changes are pushed
+//back to the file with msync only at shutdown. The mapping is shared,
+//so other processes see them at once; reverse execution's checkpoints
+//are in memory and come every few thousand steps, far too often for a
+//synchronous flush.
+typedef struct disk {
+	uint8_t *image;
+	size_t length; //bytes backed by the file, DISK_SIZE unless read-only and short
+	uint8_t writable;
+	uint8_t mounted;
+} disk;
+
+static disk disks[DISK_COUNT];
+static uint8_t blankSector[SECTOR_SIZE];
+
+//Map path as drive (0 = A:). A missing image is created and a short
+//one extended; new sectors read as 0xe5, an empty CP/M directory. A
+//short read-only image is mapped only as far as the file goes, since
+//touching a page past its end would be a SIGBUS.
+int mountDisk(int drive, const char *path) {
+	if (drive < 0 || drive >= DISK_COUNT) return 1;
+	uint8_t writable = 1;
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		writable = 0;
+		fd = open(path, O_RDONLY);
+	}
+	if (fd < 0) {
+		printf("Error: Couldn't open %s\n", path);
+		return 1;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	off_t size = st.st_size;
+	if (size < DISK_SIZE && writable && ftruncate(fd, DISK_SIZE) != 0) {
+		writable = 0;
+	}
+	size_t length = writable || size >= DISK_SIZE ? DISK_SIZE : size;
+	int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+	int flags = writable ? MAP_SHARED : MAP_PRIVATE;
+	uint8_t *image = length == 0 ? NULL : mmap(NULL, length, prot, flags, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		printf("Error: Couldn't map %s\n", path);
+		return 1;
+	}
+	if (size < DISK_SIZE && writable) {
+		memset(image + size, 0xe5, DISK_SIZE - size);
+	}
+	disks[drive].image = image;
+	disks[drive].length = length;
+	disks[drive].writable = writable;
+	disks[drive].mounted = 1;
+	return 0;
+}
+
+int diskMounted(int drive) {
+	return drive >= 0 && drive < DISK_COUNT && disks[drive].mounted;
+}
+
+//Sector address in the image, or NULL if it doesn't exist or the
+//image can't take writes. Sectors past the end of a short read-only
+//image read from a scratch copy padded with 0xe5.
+uint8_t *diskSector(int drive, uint16_t track, uint16_t sector, int forWrite) {
+	if (!diskMounted(drive) || track >= DISK_TRACKS || sector >= DISK_SPT) {
+		return NULL;
+	}
+	if (forWrite && !disks[drive].writable) {
+		return NULL;
+	}
+	size_t offset = (track * DISK_SPT + sector) * SECTOR_SIZE;
+	if (offset + SECTOR_SIZE > disks[drive].length) {
+		size_t have = offset < disks[drive].length ? disks[drive].length - offset : 0;
+		if (have) memcpy(blankSector, disks[drive].image + offset, have);
+		memset(blankSector + have, 0xe5, SECTOR_SIZE - have);
+		return blankSector;
+	}
+	return disks[drive].image + offset;
+}
+
+void syncDisks(void) {
+	for (int i = 0; i < DISK_COUNT; i++) {
+		if (disks[i].image != NULL && disks[i].writable) {
+			msync(disks[i].image, DISK_SIZE, MS_SYNC);
+		}
+	}
+}
+
+void unmountDisks(void) {
+	syncDisks();
+	for (int i = 0; i < DISK_COUNT; i++) {
+		if (disks[i].image != NULL) {
+			munmap(disks[i].image, disks[i].length);
+			disks[i].image = NULL;
+		}
+		disks[i].mounted = 0;
+	}
+}
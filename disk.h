@@ -0,0 +1,12 @@
+//IBM 3740 8" single sided single density, the standard CP/M 2.2 disk
+#define DISK_TRACKS 77
+#define DISK_SPT 26
+#define SECTOR_SIZE 128
+#define DISK_SIZE (DISK_TRACKS * DISK_SPT * SECTOR_SIZE)
+#define DISK_COUNT 4
+
+int mountDisk(int, const char*);
+int diskMounted(int);
+uint8_t *diskSector(int, uint16_t, uint16_t, int);
+void syncDisks(void);
+void unmountDisks(void);
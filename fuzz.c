@@ -0,0 +1,357 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "globals.h"
+#include "util.h"
+#include "lockstep.h"
+
+//Differential fuzzer: random and mutated instruction streams, run from
+//random register and memory states through emulateOp and the reference
+//Emulate8080Op, one worker per host core. Each worker owns its
+//machines outright, so nothing is shared on the hot path. Failing cases
+//are shrunk before they are reported.
+//
+//Because the reference core shares some of emulateOp's bugs, every case
+//also checks that PUSH rp/POP rp (and PSW) leaves emulateOp's registers
+//unchanged.
+
+void emulateOp(state8080*);
+
+#define CODE 0x0100
+#define CODE_MAX 16
+#define SNIPPET (CODE + CODE_MAX) //where the PUSH/POP round trip runs
+#define MAX_STEPS 32
+
+typedef struct fuzzCase {
+	cpuSnapshot regs;
+	uint32_t memSeed;
+	uint8_t len;
+	uint8_t code[CODE_MAX];
+} fuzzCase;
+
+typedef enum {PASS, SKIP, DIVERGED, ROUNDTRIP} outcome_kind;
+
+typedef struct worker {
+	pthread_t thread;
+	uint64_t rng;
+	uint8_t *template;
+	uint8_t *ours;
+	uint8_t *theirs;
+	char report[1024];
+} worker;
+
+//Opcodes both cores implement. IN/OUT touch the shared port latches
+//and HLT stops the machine, so they are left out.
+static uint8_t opList[256];
+static int opCount;
+static uint8_t usable[256];
+
+static _Atomic uint64_t casesRun;
+static _Atomic int stop;
+static pthread_mutex_t reportLock = PTHREAD_MUTEX_INITIALIZER;
+static int failures;
+static int checkRoundTrip = 1;
+
+static uint64_t next(uint64_t *s) {
+	uint64_t z = (*s += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+//A PUSH at this SP would land on the round-trip snippet
+static int onSnippet(uint16_t sp) {
+	return (uint16_t)(sp - SNIPPET) < 4;
+}
+
+//The reference core indexes memory[sp - 2] and memory[sp + 1] without
+//wrapping, so a stack this close to either end of the 64K would reach
+//outside the machine's block
+static int stackWraps(uint16_t sp) {
+	return sp < 2 || sp == 0xffff;
+}
+
+static void fillMemory(uint8_t *mem, uint32_t seed) {
+	uint64_t s = seed;
+	for (int i = 0; i < 0x10000; i += 8) {
+		uint64_t r = seed ? next(&s) : 0;
+		memcpy(mem + i, &r, 8);
+	}
+}
+
+static void randomCase(worker *w, fuzzCase *fc) {
+	memset(fc, 0, sizeof(*fc));
+	uint64_t r = next(&w->rng);
+	fc->regs.a = r; fc->regs.b = r >> 8; fc->regs.c = r >> 16; fc->regs.d = r >> 24;
+	fc->regs.e = r >> 32; fc->regs.h = r >> 40; fc->regs.l = r >> 48;
+	fc->regs.flags = (r >> 56) & 0x0f;
+	do {
+		fc->regs.sp = next(&w->rng);
+	} while (onSnippet(fc->regs.sp) || stackWraps(fc->regs.sp));
+	fc->regs.pc = CODE;
+	fc->memSeed = next(&w->rng) | 1;
+	fc->len = 1 + next(&w->rng) % CODE_MAX;
+	for (int i = 0; i < fc->len; i++) {
+		fc->code[i] = next(&w->rng);
+	}
+	for (int i = 0; i < fc->len; i += 3) {
+		fc->code[i] = opList[next(&w->rng) % opCount];
+	}
+}
+
+static void mutateCase(worker *w, fuzzCase *fc) {
+	uint64_t r = next(&w->rng);
+	int at = (r >> 8) % fc->len;
+	switch (r % 4) {
+		case 0: fc->code[at] = opList[(r >> 16) % opCount]; break;
+		case 1: fc->code[at] ^= 1 << ((r >> 16) % 8); break;
+		case 2: fc->regs.flags ^= 1 << ((r >> 16) % 4); break;
+		default: ((uint8_t *)&fc->regs.a)[(r >> 16) % 7] = r >> 24; break;
+	}
+}
+
+static void load(worker *w, fuzzCase *fc) {
+	fillMemory(w->template, fc->memSeed);
+	memcpy(w->template + CODE, fc->code, fc->len);
+	memcpy(w->ours, w->template, 0x10000);
+	memcpy(w->theirs, w->template, 0x10000);
+}
+
+static int roundTrip(worker *w, state8080 *state, uint8_t push) {
+	if (onSnippet(state->sp)) return 0; //the case itself moved SP there
+	cpuSnapshot before, after;
+	snapshotState(state, &before);
+	uint16_t at = SNIPPET;
+	w->ours[at] = push;
+	w->ours[at + 1] = push - 4;
+	state->pc = at;
+	emulateOp(state);
+	emulateOp(state);
+	snapshotState(state, &after);
+	after.pc = before.pc;
+	return memcmp(&before, &after, sizeof(before)) != 0;
+}
+
+static outcome_kind runCase(worker *w, fuzzCase *fc, int verbose) {
+	load(w, fc);
+	state8080 state1 = {0};
+	state8080 *state = &state1;
+	state->memory = w->ours;
+	state->memSize = 0x10000;
+	restoreState(state, &fc->regs);
+	cpuSnapshot theirs = fc->regs;
+	cpuSnapshot ours;
+	char *rep = w->report;
+	size_t room = sizeof(w->report);
+
+	jmp_buf fault;
+	if (setjmp(fault) != 0) {
+		faultHandler = NULL;
+		return SKIP;
+	}
+	faultHandler = &fault;
+	for (int step = 0; step < MAX_STEPS; step++) {
+		if (state->pc < CODE || state->pc >= CODE + fc->len) break;
+		if (stackWraps(state->sp)) break; //the case moved it there
+		uint16_t pc = state->pc;
+		if (!usable[w->ours[pc]]) break;
+		emulateOp(state);
+		if (stepReference(&theirs, w->theirs)) break;
+		snapshotState(state, &ours);
+		int memDiff = memcmp(w->ours, w->theirs, 0x10000) != 0;
+		if (memcmp(&ours, &theirs, sizeof(ours)) != 0 || memDiff) {
+			faultHandler = NULL;
+			if (verbose) {
+				int n = snprintf(rep, room, "diverged at step %d, $%04x opcode $%02x\n", step, pc, w->template[pc]);
+				n += snprintf(rep + n, room - n,
+						"\temulateOp PC:$%04x SP:$%04x A:$%02x B:$%02x C:$%02x D:$%02x E:$%02x H:$%02x L:$%02x F:%x\n",
+						ours.pc, ours.sp, ours.a, ours.b, ours.c, ours.d, ours.e, ours.h, ours.l, ours.flags);
+				n += snprintf(rep + n, room - n,
+						"\treference PC:$%04x SP:$%04x A:$%02x B:$%02x C:$%02x D:$%02x E:$%02x H:$%02x L:$%02x F:%x\n",
+						theirs.pc, theirs.sp, theirs.a, theirs.b, theirs.c, theirs.d, theirs.e, theirs.h, theirs.l, theirs.flags);
+				for (int i = 0; memDiff && i < 0x10000 && n < (int)room - 80; i++) {
+					if (w->ours[i] != w->theirs[i]) {
+						n += snprintf(rep + n, room - n, "\tmem[$%04x]: emulateOp $%02x, reference $%02x\n",
+								i, w->ours[i], w->theirs[i]);
+					}
+				}
+			}
+			return DIVERGED;
+		}
+	}
+	static const uint8_t pushes[4] = {0xc5, 0xd5, 0xe5, 0xf5};
+	for (int i = 0; checkRoundTrip && i < 4; i++) {
+		if (roundTrip(w, state, pushes[i])) {
+			faultHandler = NULL;
+			if (verbose) {
+				snprintf(rep, room, "PUSH/POP $%02x/$%02x does not restore the registers it saved\n",
+						pushes[i], pushes[i] - 4);
+			}
+			return ROUNDTRIP;
+		}
+	}
+	faultHandler = NULL;
+	return PASS;
+}
+
+//Greedy shrinking: drop code bytes, then zero registers and memory,
+//keeping each change that still fails the same way.
+static void shrinkCase(worker *w, fuzzCase *fc, outcome_kind kind) {
+	int progress = 1;
+	while (progress) {
+		progress = 0;
+		for (int i = fc->len - 1; i >= 0 && fc->len > 1; i--) {
+			fuzzCase t = *fc;
+			memmove(t.code + i, t.code + i + 1, t.len - i - 1);
+			t.len--;
+			if (runCase(w, &t, 0) == kind) {
+				*fc = t;
+				progress = 1;
+			}
+		}
+		uint8_t *regs[7] = {&fc->regs.a, &fc->regs.b, &fc->regs.c, &fc->regs.d,
+			&fc->regs.e, &fc->regs.h, &fc->regs.l};
+		for (int i = 0; i < 7; i++) {
+			if (*regs[i] == 0) continue;
+			uint8_t saved = *regs[i];
+			*regs[i] = 0;
+			if (runCase(w, fc, 0) == kind) progress = 1;
+			else *regs[i] = saved;
+		}
+		if (fc->regs.flags) {
+			uint8_t saved = fc->regs.flags;
+			fc->regs.flags = 0;
+			if (runCase(w, fc, 0) == kind) progress = 1;
+			else fc->regs.flags = saved;
+		}
+		if (fc->memSeed) {
+			uint32_t saved = fc->memSeed;
+			fc->memSeed = 0;
+			if (runCase(w, fc, 0) == kind) progress = 1;
+			else fc->memSeed = saved;
+		}
+	}
+}
+
+static void report(worker *w, fuzzCase *fc, outcome_kind kind) {
+	runCase(w, fc, 1);
+	pthread_mutex_lock(&reportLock);
+	if (!atomic_load(&stop)) {
+		failures++;
+		printf("fuzz: failing case after %llu cases\n", (unsigned long long)atomic_load(&casesRun));
+		printf("\tcode @ $%04x:", CODE);
+		for (int i = 0; i < fc->len; i++) printf(" %02x", fc->code[i]);
+		printf("\n\tregs: SP:$%04x A:$%02x B:$%02x C:$%02x D:$%02x E:$%02x H:$%02x L:$%02x F:%x memSeed:%u\n",
+				fc->regs.sp, fc->regs.a, fc->regs.b, fc->regs.c, fc->regs.d, fc->regs.e,
+				fc->regs.h, fc->regs.l, fc->regs.flags, fc->memSeed);
+		printf("\t%s", w->report);
+		atomic_store(&stop, 1);
+	}
+	pthread_mutex_unlock(&reportLock);
+}
+
+static void *workerMain(void *arg) {
+	worker *w = arg;
+	fuzzCase fc;
+	randomCase(w, &fc);
+	uint64_t local = 0;
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		if (next(&w->rng) % 2) {
+			randomCase(w, &fc);
+		} else {
+			mutateCase(w, &fc);
+		}
+		outcome_kind kind = runCase(w, &fc, 0);
+		if (kind == DIVERGED || kind == ROUNDTRIP) {
+			shrinkCase(w, &fc, kind);
+			report(w, &fc, kind);
+		}
+		if (++local % 256 == 0) {
+			atomic_fetch_add_explicit(&casesRun, 256, memory_order_relaxed);
+		}
+	}
+	atomic_fetch_add_explicit(&casesRun, local % 256, memory_order_relaxed);
+	return NULL;
+}
+
+//Which opcodes both cores can execute
+static void probeOpcodes(void) {
+	uint8_t *mem = calloc(1, 0x10000);
+	state8080 state1 = {0};
+	state1.memory = mem;
+	state1.memSize = 0x10000;
+	for (int op = 0; op < 256; op++) {
+		if (op == 0x76 || op == 0xd3 || op == 0xdb) continue;
+		memset(mem, 0, 0x10000);
+		mem[CODE] = op;
+		cpuSnapshot snap = {CODE, 0x8000};
+		if (stepReference(&snap, mem)) continue;
+		restoreState(&state1, &(cpuSnapshot){CODE, 0x8000});
+		memset(mem, 0, 0x10000);
+		mem[CODE] = op;
+		jmp_buf fault;
+		if (setjmp(fault) == 0) {
+			faultHandler = &fault;
+			emulateOp(&state1);
+			opList[opCount++] = op;
+			usable[op] = 1;
+		}
+		faultHandler = NULL;
+	}
+	free(mem);
+}
+
+//usage: fuzz [-j threads] [-t seconds] [-s seed] [-n]
+//-n skips the PUSH/POP round trip check
+int main(int argc, char **argv) {
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int seconds = 10;
+	uint64_t seed = time(NULL);
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threads = atol(argv[++i]);
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			seconds = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			seed = strtoull(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "-n") == 0) {
+			checkRoundTrip = 0;
+		}
+	}
+	if (threads < 1) threads = 1;
+	isTracing = 0;
+
+	probeOpcodes();
+	printf("fuzz: %d opcodes implemented by both cores, %ld threads, seed %llu\n",
+			opCount, threads, (unsigned long long)seed);
+
+	worker *workers = calloc(threads, sizeof(worker));
+	for (long i = 0; i < threads; i++) {
+		workers[i].rng = seed + i * 0x632be59bd9b4e019ULL;
+		workers[i].template = malloc(0x10000);
+		workers[i].ours = malloc(0x10000);
+		workers[i].theirs = malloc(0x10000);
+	}
+	for (long i = 0; i < threads; i++) {
+		pthread_create(&workers[i].thread, NULL, workerMain, &workers[i]);
+	}
+	struct timespec tick = {0, 100000000};
+	for (int t = 0; t < seconds * 10 && !atomic_load(&stop); t++) {
+		nanosleep(&tick, NULL);
+	}
+	atomic_store(&stop, 1);
+	for (long i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		free(workers[i].template);
+		free(workers[i].ours);
+		free(workers[i].theirs);
+	}
+	free(workers);
+	printf("fuzz: %llu cases, %d failing\n", (unsigned long long)atomic_load(&casesRun), failures);
+	return failures != 0;
+}
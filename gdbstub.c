@@ -0,0 +1,489 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "globals.h"
+#include "debugger.h"
+#include "checkpoint.h"
+#include "gdbstub.h"
+
+//GDB remote serial protocol stub. A network thread accepts one debugger
+//at a time, checks packet framing and acks, and queues payloads; a
+//Ctrl-C from the debugger just asks the run loop to stop. Packets are
+//only acted on from the debugger's stop handler, on the emulating
+//thread, so state8080 never has two writers and a connected debugger
+//costs nothing while the guest runs.
+//
+//Registers use GDB's z80 layout (set architecture z80): af bc de hl sp
+//pc ix iy af' bc' de' hl' ir, 16 bits each, little endian. The 8080
+//has the first six; F is the PSW byte, which has the z80 flag layout.
+#define PACKET_MAX 4096
+#define QUEUE_LEN 16
+#define REG_COUNT 13
+
+static int listenFd = -1;
+static int clientFd = -1;
+static pthread_t netThread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t arrived = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t sendLock = PTHREAD_MUTEX_INITIALIZER;
+static char queue[QUEUE_LEN][PACKET_MAX];
+static int queueHead, queueTail;
+static uint8_t connected;
+static uint8_t attachedOnce;
+static uint8_t exitSent;
+static uint8_t replyPending; //a c or s is waiting for its stop reply
+static char socketPath[108];
+//What the debugger inserted, taken out again when it detaches or goes
+//away, so a later hit doesn't wait for a debugger that isn't there
+static uint8_t stubBreaks[0x2000];
+static watchpoint stubWatches[MAX_WATCHES];
+static int stubWatchCount;
+
+static void sendPacket(const char *payload) {
+	static char buf[PACKET_MAX + 4];
+	uint8_t sum = 0;
+	size_t n = strlen(payload);
+	for (size_t i = 0; i < n; i++) sum += (uint8_t)payload[i];
+	pthread_mutex_lock(&sendLock);
+	int len = snprintf(buf, sizeof(buf), "$%s#%02x", payload, sum);
+	if (clientFd >= 0 && write(clientFd, buf, len) != len) {
+		//the network thread notices the hangup
+	}
+	pthread_mutex_unlock(&sendLock);
+}
+
+static void enqueue(const char *payload) {
+	pthread_mutex_lock(&lock);
+	if (queueTail - queueHead < QUEUE_LEN) {
+		snprintf(queue[queueTail % QUEUE_LEN], PACKET_MAX, "%s", payload);
+		queueTail++;
+	}
+	pthread_cond_signal(&arrived);
+	pthread_mutex_unlock(&lock);
+}
+
+static int hexVal(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+//Reads framed packets off one connection until it closes
+static void serveClient(int fd) {
+	char payload[PACKET_MAX];
+	int len = 0, state = 0, check = 0;
+	uint8_t sum = 0;
+	char c;
+	while (read(fd, &c, 1) == 1) {
+		switch (state) {
+			case 0: //between packets
+				if (c == 0x03) {
+					requestStop();
+				} else if (c == '$') {
+					len = 0;
+					sum = 0;
+					state = 1;
+				}
+				break;
+			case 1: //payload
+				if (c == '#') {
+					state = 2;
+					check = 0;
+				} else if (len < PACKET_MAX - 1) {
+					payload[len++] = c;
+					sum += (uint8_t)c;
+				}
+				break;
+			case 2: //first checksum digit
+				check = hexVal(c) << 4;
+				state = 3;
+				break;
+			default: //second checksum digit
+				check |= hexVal(c);
+				state = 0;
+				payload[len] = '\0';
+				pthread_mutex_lock(&sendLock);
+				if (write(fd, check == sum ? "+" : "-", 1) != 1) {
+					//hangup shows up on the next read
+				}
+				pthread_mutex_unlock(&sendLock);
+				if (check == sum) enqueue(payload);
+				break;
+		}
+	}
+}
+
+static void *netMain(void *arg) {
+	for (;;) {
+		int fd = accept(listenFd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR) continue;
+			return NULL;
+		}
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		pthread_mutex_lock(&sendLock);
+		clientFd = fd;
+		pthread_mutex_unlock(&sendLock);
+		pthread_mutex_lock(&lock);
+		connected = 1;
+		attachedOnce = 1;
+		pthread_mutex_unlock(&lock);
+		fprintf(stderr, "gdb: debugger connected\n");
+		requestStop();
+
+		serveClient(fd);
+
+		pthread_mutex_lock(&sendLock);
+		clientFd = -1;
+		pthread_mutex_unlock(&sendLock);
+		close(fd);
+		pthread_mutex_lock(&lock);
+		connected = 0;
+		pthread_cond_signal(&arrived);
+		pthread_mutex_unlock(&lock);
+		fprintf(stderr, "gdb: debugger disconnected\n");
+		requestStop(); //so gdbStop clears its stops away on the emulating thread
+	}
+	return NULL;
+}
+
+static uint8_t getPsw(state8080 *state) {
+	return state->cc.s << 7 | state->cc.z << 6 | state->cc.ac << 4 | state->cc.p << 2 | 0x02 | state->cc.cy;
+}
+
+static void setPsw(state8080 *state, uint8_t psw) {
+	state->cc.s = (psw >> 7) & 1;
+	state->cc.z = (psw >> 6) & 1;
+	state->cc.ac = (psw >> 4) & 1;
+	state->cc.p = (psw >> 2) & 1;
+	state->cc.cy = psw & 1;
+}
+
+static uint16_t getReg(state8080 *state, int n) {
+	switch (n) {
+		case 0: return state->a << 8 | getPsw(state);
+		case 1: return state->b << 8 | state->c;
+		case 2: return state->d << 8 | state->e;
+		case 3: return state->h << 8 | state->l;
+		case 4: return state->sp;
+		case 5: return state->pc;
+		default: return 0;
+	}
+}
+
+static void setReg(state8080 *state, int n, uint16_t v) {
+	switch (n) {
+		case 0: state->a = v >> 8; setPsw(state, v & 0xff); break;
+		case 1: state->b = v >> 8; state->c = v & 0xff; break;
+		case 2: state->d = v >> 8; state->e = v & 0xff; break;
+		case 3: state->h = v >> 8; state->l = v & 0xff; break;
+		case 4: state->sp = v; break;
+		case 5: state->pc = v; break;
+		default: break;
+	}
+}
+
+static void stopReply(state8080 *state) {
+	char reply[64];
+	stopInfo stop = lastStopInfo();
+	if (stop.kind == STOP_WATCH) {
+		snprintf(reply, sizeof(reply), "T05%swatch:%04x;", stop.write ? "" : "r", stop.addr);
+	} else {
+		snprintf(reply, sizeof(reply), "S05");
+	}
+	sendPacket(reply);
+}
+
+static uint16_t hexWord(const char **p) {
+	uint32_t v = 0;
+	int d;
+	while ((d = hexVal(**p)) >= 0) {
+		v = (v << 4) | d;
+		(*p)++;
+	}
+	return v;
+}
+
+//z/Z packets: type,addr,kind
+static void breakpointPacket(const char *p) {
+	int insert = p[0] == 'Z';
+	int type = p[1] - '0';
+	p += 3;
+	uint16_t addr = hexWord(&p);
+	p++;
+	uint16_t len = hexWord(&p);
+	if (len == 0) len = 1;
+	int err;
+	switch (type) {
+		case 0: case 1:
+			if (insert) {
+				setBreakpoint(addr);
+				stubBreaks[addr >> 3] |= 1 << (addr & 7);
+			} else {
+				clearBreakpoint(addr);
+				stubBreaks[addr >> 3] &= ~(1 << (addr & 7));
+			}
+			sendPacket("OK");
+			return;
+		case 2: case 3: case 4: {
+			uint8_t kind = type == 2 ? WATCH_WRITE : type == 3 ? WATCH_READ : WATCH_READ | WATCH_WRITE;
+			uint16_t end = addr + len - 1;
+			err = insert ? addWatchpoint(addr, end, kind) : removeWatchpoint(addr, end, kind);
+			if (!err && insert && stubWatchCount < MAX_WATCHES) {
+				stubWatches[stubWatchCount++] = (watchpoint){addr, end, kind};
+			}
+			for (int i = 0; !err && !insert && i < stubWatchCount; i++) {
+				watchpoint *w = &stubWatches[i];
+				if (w->start == addr && w->end == end && w->kind == kind) {
+					*w = stubWatches[--stubWatchCount];
+					break;
+				}
+			}
+			sendPacket(err ? "E01" : "OK");
+			return;
+		}
+		default:
+			sendPacket("");
+	}
+}
+
+static void dropStubStops(void) {
+	for (int addr = 0; addr < 0x10000; addr++) {
+		if (stubBreaks[addr >> 3] & (1 << (addr & 7))) clearBreakpoint(addr);
+	}
+	memset(stubBreaks, 0, sizeof(stubBreaks));
+	for (int i = 0; i < stubWatchCount; i++) {
+		removeWatchpoint(stubWatches[i].start, stubWatches[i].end, stubWatches[i].kind);
+	}
+	stubWatchCount = 0;
+	debugStep(0);
+	replyPending = 0;
+}
+
+//Handles one packet; returns 1 when the guest should run again
+static int handlePacket(state8080 *state, const char *pkt) {
+	static char reply[PACKET_MAX];
+	const char *p = pkt + 1;
+	switch (pkt[0]) {
+		case '?':
+			stopReply(state);
+			return 0;
+		case 'g':
+			for (int i = 0; i < REG_COUNT; i++) {
+				uint16_t v = getReg(state, i);
+				sprintf(reply + i * 4, "%02x%02x", v & 0xff, v >> 8);
+			}
+			sendPacket(reply);
+			return 0;
+		case 'G':
+			checkpointDiverged();
+			for (int i = 0; i < REG_COUNT && strlen(p) >= 4; i++, p += 4) {
+				setReg(state, i, hexVal(p[0]) << 4 | hexVal(p[1]) | (hexVal(p[2]) << 12 | hexVal(p[3]) << 8));
+			}
+			sendPacket("OK");
+			return 0;
+		case 'p': {
+			int n = hexWord(&p);
+			uint16_t v = getReg(state, n);
+			sprintf(reply, "%02x%02x", v & 0xff, v >> 8);
+			sendPacket(reply);
+			return 0;
+		}
+		case 'P': {
+			checkpointDiverged();
+			int n = hexWord(&p);
+			p++;
+			if (strlen(p) >= 4) setReg(state, n, hexVal(p[0]) << 4 | hexVal(p[1]) | (hexVal(p[2]) << 12 | hexVal(p[3]) << 8));
+			sendPacket("OK");
+			return 0;
+		}
+		case 'm': {
+			uint32_t addr = hexWord(&p);
+			p++;
+			uint32_t len = hexWord(&p);
+			if (len > (PACKET_MAX - 1) / 2) len = (PACKET_MAX - 1) / 2;
+			if (addr >= state->memSize) {
+				sendPacket("E01");
+				return 0;
+			}
+			if (addr + len > state->memSize) len = state->memSize - addr;
+			for (uint32_t i = 0; i < len; i++) sprintf(reply + i * 2, "%02x", state->memory[addr + i]);
+			reply[len * 2] = '\0';
+			sendPacket(reply);
+			return 0;
+		}
+		case 'M': {
+			uint32_t addr = hexWord(&p);
+			p++;
+			uint32_t len = hexWord(&p);
+			p++;
+			if (addr + len > state->memSize) {
+				sendPacket("E01");
+				return 0;
+			}
+			checkpointPoke(state, addr, len);
+			for (uint32_t i = 0; i < len && p[0] && p[1]; i++, p += 2) {
+				state->memory[addr + i] = hexVal(p[0]) << 4 | hexVal(p[1]);
+			}
+			sendPacket("OK");
+			return 0;
+		}
+		case 'c':
+		case 's':
+			if (*p) {
+				checkpointDiverged();
+				state->pc = hexWord(&p);
+			}
+			if (pkt[0] == 's') debugStep(1);
+			replyPending = 1;
+			return 1;
+		case 'b':
+			//bs/bc: reverse step and continue, answered without resuming
+			if (!checkpointsOn || (*p != 's' && *p != 'c')) {
+				sendPacket("");
+			} else if (*p == 's' ? reverseStep(state, 1) : reverseContinue(state)) {
+				sendPacket("T05replaylog:begin;");
+			} else {
+				stopReply(state);
+			}
+			return 0;
+		case 'Z':
+		case 'z':
+			breakpointPacket(pkt);
+			return 0;
+		case 'k':
+			exit(0);
+		case 'D':
+			sendPacket("OK");
+			dropStubStops();
+			return 1;
+		case 'q':
+			if (strncmp(pkt, "qSupported", 10) == 0) {
+				sprintf(reply, "PacketSize=%x%s", PACKET_MAX - 1,
+						checkpointsOn ? ";ReverseStep+;ReverseContinue+" : "");
+				sendPacket(reply);
+			} else if (strcmp(pkt, "qAttached") == 0) {
+				sendPacket("1");
+			} else if (strcmp(pkt, "qC") == 0) {
+				sendPacket("QC1");
+			} else {
+				sendPacket("");
+			}
+			return 0;
+		case 'H':
+			sendPacket("OK");
+			return 0;
+		default:
+			sendPacket("");
+			return 0;
+	}
+}
+
+//Stop handler while the stub is listening
+static void gdbStop(state8080 *state) {
+	pthread_mutex_lock(&lock);
+	//nobody attached yet: wait for one, the connect asks for a stop
+	//anyway. Once one has come and gone, run on.
+	while (!connected && !attachedOnce) pthread_cond_wait(&arrived, &lock);
+	pthread_mutex_unlock(&lock);
+	if (replyPending) {
+		replyPending = 0;
+		stopReply(state);
+	}
+	for (;;) {
+		char pkt[PACKET_MAX];
+		pthread_mutex_lock(&lock);
+		while (queueHead == queueTail && connected) pthread_cond_wait(&arrived, &lock);
+		if (!connected) {
+			//debugger went away: drop its stops and run on
+			queueHead = queueTail = 0;
+			pthread_mutex_unlock(&lock);
+			dropStubStops();
+			return;
+		}
+		memcpy(pkt, queue[queueHead % QUEUE_LEN], PACKET_MAX);
+		queueHead++;
+		pthread_mutex_unlock(&lock);
+		if (handlePacket(state, pkt)) return;
+	}
+}
+
+static void removeSocket(void) {
+	if (socketPath[0]) unlink(socketPath);
+}
+
+//Any exit, an unimplemented opcode's exit(1) included, ends the session
+static void onExit(int status, void *arg) {
+	stopGdbStub(status);
+}
+
+//":port" or a bare number listens on localhost TCP, anything else is a
+//Unix socket path
+int startGdbStub(const char *spec) {
+	char *end;
+	long port = strtol(spec[0] == ':' ? spec + 1 : spec, &end, 10);
+	if (*end == '\0' && port > 0 && port < 65536) {
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		listenFd = socket(AF_INET, SOCK_STREAM, 0);
+		int one = 1;
+		setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (listenFd < 0 || bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			fprintf(stderr, "gdb: couldn't listen on port %ld: %s\n", port, strerror(errno));
+			return 1;
+		}
+	} else {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", spec);
+		//only clear away a stale socket, never an ordinary file
+		struct stat st;
+		if (lstat(spec, &st) == 0) {
+			if (!S_ISSOCK(st.st_mode)) {
+				fprintf(stderr, "gdb: %s exists and isn't a socket\n", spec);
+				return 1;
+			}
+			unlink(spec);
+		}
+		listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listenFd < 0 || bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			fprintf(stderr, "gdb: couldn't listen on %s: %s\n", spec, strerror(errno));
+			return 1;
+		}
+		snprintf(socketPath, sizeof(socketPath), "%s", spec);
+		atexit(removeSocket);
+	}
+	listen(listenFd, 1);
+	on_exit(onExit, NULL);
+	setStopHandler(gdbStop);
+	pthread_create(&netThread, NULL, netMain, NULL);
+	pthread_detach(netThread);
+	fprintf(stderr, "gdb: waiting for a debugger on %s\n", spec);
+	return 0;
+}
+
+//Tell an attached debugger the guest is gone
+void stopGdbStub(int status) {
+	if (connected && !exitSent) {
+		exitSent = 1;
+		char reply[8];
+		snprintf(reply, sizeof(reply), "W%02x", status & 0xff);
+		sendPacket(reply);
+	}
+}
@@ -0,0 +1,2 @@
+int startGdbStub(const char*);
+void stopGdbStub(int);
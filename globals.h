@@ -1,6 +1,14 @@
-#define DEBUG 1
+//build with -DDEBUG_BUILD=0 to compile the instruction trace out entirely
+#ifndef DEBUG_BUILD
+#define DEBUG_BUILD 1
+#endif
+#define DEBUG (DEBUG_BUILD && isTracing)
 #define PRINT_DEBUG (DEBUG && !isStepMode)
 
+#define CPU_HZ 2000000
+#define FRAME_HZ 60
+#define CYCLES_PER_FRAME (CPU_HZ / FRAME_HZ)
+
 typedef struct conditionCodes {
 	uint8_t z:1; //zero
 	uint8_t s:1; //sign, 1 if -, 0 if +
@@ -21,15 +29,17 @@ typedef struct state8080 {
 	uint16_t sp;
 	uint16_t pc;
 	uint8_t *memory;
-	uint16_t memSize;
+	uint32_t memSize;
 	struct conditionCodes cc;
 	uint8_t int_enable;
+	uint8_t halted;
 } state8080;
 
 typedef enum {ADD, SUB} carry_kind;
 typedef enum {BC, DE, HL, SP} registerPair_kind;
 typedef enum {A, B, C, D, E, H, L, M} register_kind;
 
-register_kind regs[8];
-registerPair_kind rps[4];
-uint8_t isStepMode;
\ No newline at end of file
+extern register_kind regs[8];
+extern registerPair_kind rps[4];
+extern uint8_t isStepMode;
+extern uint8_t isTracing;
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "hwcounters.h"
+
+//Host hardware counters around the run loop, from perf_event_open. The
+//counters are opened as one group (user space only, this thread) so
+//they start, stop and read together; the group is read at every frame
+//boundary and the deltas are summed. Counters the host doesn't have are
+//left out; with none at all it falls back to the software task clock,
+//and with no perf support it says so and the run goes on.
+typedef struct counterDef {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} counterDef;
+
+static const counterDef hardware[] = {
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+};
+static const counterDef fallback = {"task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK};
+
+#define MAX_COUNTERS 4
+
+static int fds[MAX_COUNTERS];
+static const counterDef *opened[MAX_COUNTERS];
+static int nopened;
+static uint64_t last[MAX_COUNTERS];
+static uint64_t total[MAX_COUNTERS];
+static uint64_t worst[MAX_COUNTERS]; //largest single frame
+static uint64_t frames;
+static const uint64_t *guestInstrs;
+
+static int openCounter(const counterDef *def, int group) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = def->type;
+	attr.config = def->config;
+	attr.disabled = group == -1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static int readGroup(uint64_t *values) {
+	uint64_t buf[1 + MAX_COUNTERS];
+	ssize_t want = sizeof(uint64_t) * (1 + nopened);
+	if (read(fds[0], buf, want) != want) return 1;
+	memcpy(values, buf + 1, sizeof(uint64_t) * nopened);
+	return 0;
+}
+
+int startHwCounters(const uint64_t *instrs) {
+	guestInstrs = instrs;
+	int err = 0;
+	for (size_t i = 0; i < sizeof(hardware) / sizeof(hardware[0]); i++) {
+		int fd = openCounter(&hardware[i], nopened ? fds[0] : -1);
+		if (fd < 0) {
+			err = errno;
+			continue;
+		}
+		fds[nopened] = fd;
+		opened[nopened++] = &hardware[i];
+	}
+	if (nopened == 0) {
+		int fd = openCounter(&fallback, -1);
+		if (fd < 0) {
+			fprintf(stderr, "hwcounters: perf_event_open unavailable (%s), not measuring\n", strerror(errno));
+			return 1;
+		}
+		fprintf(stderr, "hwcounters: no hardware counters (%s), using the task clock\n", strerror(err));
+		fds[0] = fd;
+		opened[nopened++] = &fallback;
+	}
+	ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	memset(last, 0, sizeof(last));
+	return 0;
+}
+
+void hwCountersFrame(void) {
+	if (nopened == 0) return;
+	uint64_t now[MAX_COUNTERS];
+	if (readGroup(now)) return;
+	for (int i = 0; i < nopened; i++) {
+		uint64_t delta = now[i] - last[i];
+		total[i] += delta;
+		if (delta > worst[i]) worst[i] = delta;
+		last[i] = now[i];
+	}
+	frames++;
+}
+
+void stopHwCounters(void) {
+	if (nopened == 0) return;
+	//the partial frame at the end adds to the totals, not the frame
+	//count or the worst frame
+	uint64_t now[MAX_COUNTERS];
+	if (readGroup(now) == 0) {
+		for (int i = 0; i < nopened; i++) total[i] += now[i] - last[i];
+	}
+	ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	double millions = *guestInstrs / 1e6;
+	fprintf(stderr, "hwcounters: %llu frames, %llu guest instructions\n",
+			(unsigned long long)frames, (unsigned long long)*guestInstrs);
+	fprintf(stderr, "\t%-14s %16s %14s %14s %16s\n", "counter", "total", "per frame", "worst frame", "per M guest instr");
+	for (int i = 0; i < nopened; i++) {
+		fprintf(stderr, "\t%-14s %16llu %14.0f %14llu %16.0f\n", opened[i]->name, (unsigned long long)total[i],
+				frames ? (double)total[i] / frames : 0, (unsigned long long)worst[i],
+				millions > 0 ? total[i] / millions : 0);
+	}
+	for (int i = 0; i < nopened; i++) close(fds[i]);
+	nopened = 0;
+}
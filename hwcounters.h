@@ -0,0 +1,3 @@
+int startHwCounters(const uint64_t*);
+void hwCountersFrame(void);
+void stopHwCounters(void);
@@ -2,9 +2,30 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <signal.h>
 #include "disassembler.h"
 #include "globals.h"
 #include "util.h"
+#include "capture.h"
+#include "sounds.h"
+#include "mixer.h"
+#include "pacing.h"
+#include "cpm.h"
+#include "console.h"
+#include "disk.h"
+#include "lockstep.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "stats.h"
+#include "sampler.h"
+#include "hwcounters.h"
+#include "memaccess.h"
+#include "coverage.h"
+#include "debugger.h"
+#include "gdbstub.h"
+#include "checkpoint.h"
+#include "trace.h"
 
 #include "instrs/arithmetic.h"
 #include "instrs/branching.h"
@@ -12,13 +33,25 @@
 #include "instrs/dataTransfer.h"
 #include "instrs/stack.h"
 
-#include "8080emu-first50.c"
-
-#define FOR_CPUDIAG 1
-
 register_kind regs[8] = {B, C, D, E, H, L, M, A};
 registerPair_kind rps[4] = {BC, DE, HL, SP};
 uint8_t isStepMode = 0;
+uint8_t isTracing = 1;
+
+//run loop totals, reported by turbo mode on exit
+static uint64_t totalCycles;
+static uint64_t totalInstrs;
+static uint64_t totalFrames;
+static struct timespec runStart;
+
+static void reportTurbo(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double wall = (now.tv_sec - runStart.tv_sec) + (now.tv_nsec - runStart.tv_nsec) / 1e9;
+	double emulated = (double)totalCycles / CPU_HZ;
+	fprintf(stderr, "turbo: %llu frames, %.3f emulated s in %.3f wall s (%.2f emulated s per wall s)\n",
+			(unsigned long long)totalFrames, emulated, wall, wall > 0 ? emulated / wall : 0);
+}
 
 void emulateOp(state8080*);
 
@@ -759,40 +792,185 @@ void emulateOp(state8080 *state) {
         case 0xf9:
             sphl(state);
             break;
-        //case 0x76:
-            //TODO: halt instruction.
+        case 0xdb:
+            in(state, opcode);
+            state->pc += 1;
+            break;
+        case 0xd3:
+            out(state, opcode);
+            state->pc += 1;
+            break;
+        case 0x76:
+            hlt(state);
             break;
 
 		default: unimplementedInstr(state); break;
 	}
 }
 
+#ifndef NO_MAIN
 int main(int argc, char **argv) {
 	state8080 state1 = {0};
     state8080 *state = &state1;
+	char *capturePath = NULL;
+	char *soundDir = NULL;
+	char *audioPath = NULL;
+	uint8_t paced = 0;
+	uint8_t turbo = 0;
+	uint8_t cpm = 0;
+	int consoleFd = -1;
+	uint8_t lockstep = 0;
+	char *diskPaths[DISK_COUNT] = {NULL};
+	int diskCount = 0;
+	uint32_t renderEvery = 1; //capture every Nth frame, 0 for never
+	char *profilePath = NULL;
+	char *listingPath = NULL;
+	int listingBase = -1;
+	char *callsPath = NULL;
+	char *statsPath = NULL;
+	char *samplePath = NULL;
+	uint32_t sampleHz = 1000;
+	uint8_t hwCounters = 0;
+	char *coveragePath = NULL;
+	char *gdbSpec = NULL;
+	uint32_t reverseMb = 0;
+	char *tracePath = NULL;
+	uint32_t traceLen = 1 << 20;
 
-	if (argc > 2) {
-		if (strcmp(argv[1], "-d") == 0){
+	for (int i = 1; i < argc - 1; i++) {
+		if (strcmp(argv[i], "-d") == 0){
 			isStepMode = 1;
+		} else if (strcmp(argv[i], "-p") == 0) {
+			paced = 1;
+		} else if (strcmp(argv[i], "-l") == 0) {
+			lockstep = 1;
+		} else if (strcmp(argv[i], "-cpm") == 0) {
+			cpm = 1;
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc - 1) {
+			turbo = 1;
+			renderEvery = strtoul(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "-disk") == 0 && i + 1 < argc - 1) {
+			if (diskCount < DISK_COUNT) diskPaths[diskCount++] = argv[i + 1];
+			i++;
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc - 1) {
+			consoleFd = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc - 1) {
+			capturePath = argv[++i];
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc - 1) {
+			soundDir = argv[++i];
+		} else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc - 1) {
+			audioPath = argv[++i];
+		} else if (strcmp(argv[i], "-prof") == 0 && i + 1 < argc - 1) {
+			profilePath = argv[++i];
+		} else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc - 1) {
+			statsPath = argv[++i];
+		} else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc - 1) {
+			tracePath = argv[++i];
+		} else if (strcmp(argv[i], "-tracelen") == 0 && i + 1 < argc - 1) {
+			traceLen = strtoul(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "-rev") == 0 && i + 1 < argc - 1) {
+			reverseMb = strtoul(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "-gdb") == 0 && i + 1 < argc - 1) {
+			gdbSpec = argv[++i];
+		} else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc - 1) {
+			char err[96];
+			if (parseBreakpoint(argv[++i], err, sizeof(err))) {
+				printf("Error: breakpoint %s: %s\n", argv[i], err);
+				exit(1);
+			}
+		} else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc - 1) {
+			uint16_t start, end;
+			uint8_t kind;
+			if (parseWatch(argv[++i], &start, &end, &kind) || addWatchpoint(start, end, kind)) {
+				printf("Error: bad watchpoint %s\n", argv[i]);
+				exit(1);
+			}
+		} else if (strcmp(argv[i], "-cov") == 0 && i + 1 < argc - 1) {
+			coveragePath = argv[++i];
+		} else if (strcmp(argv[i], "-hw") == 0) {
+			hwCounters = 1;
+		} else if (strcmp(argv[i], "-sample") == 0 && i + 1 < argc - 1) {
+			samplePath = argv[++i];
+		} else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc - 1) {
+			sampleHz = strtoul(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "-calls") == 0 && i + 1 < argc - 1) {
+			callsPath = argv[++i];
+		} else if (strcmp(argv[i], "-lst") == 0 && i + 1 < argc - 1) {
+			listingPath = argv[++i];
+		} else if (strcmp(argv[i], "-lstbase") == 0 && i + 1 < argc - 1) {
+			listingBase = strtoul(argv[++i], NULL, 16) & 0xffff;
 		}
 	}
 
 	FILE *f = fopen(argv[argc - 1], "rb");
 	if (f == NULL) {
-		printf("Error: Couldn't open %s\n", argv[1]);
+		printf("Error: Couldn't open %s\n", argv[argc - 1]);
 		exit(1);
 	}
 
 	fseek(f, 0L, SEEK_END);
 	int fsize = ftell(f);
 	state->memSize = fsize + 1024; //extra space for data storage
+	if (state->memSize < VRAM_START + VRAM_SIZE) {
+		state->memSize = VRAM_START + VRAM_SIZE; //room for video ram
+	}
+	if (cpm) {
+		state->memSize = 0x10000;
+	}
 	fseek(f, 0L, SEEK_SET);
 	uint8_t *buffer = (uint8_t *)calloc(1, state->memSize);
-//	fread(buffer + 0x0100, fsize, 1, f);
-    fread(buffer, fsize, 1, f);
+	if (cpm) {
+		fread(buffer + CPM_TPA, fsize, 1, f);
+	} else {
+		fread(buffer, fsize, 1, f);
+	}
 	fclose(f);
 
     state->memory = buffer;
+	if (cpm) {
+		loadCpm(state);
+		initConsole(consoleFd);
+		atexit(flushConsole);
+		for (int i = 0; i < diskCount; i++) {
+			if (mountDisk(i, diskPaths[i])) {
+				exit(1);
+			}
+		}
+		atexit(unmountDisks);
+	}
+
+	//turbo runs the same machine with the presentation stages switched
+	//off: no pacing, no audio mixing, no per-instruction trace and only
+	//every Nth frame rendered
+	if (turbo) {
+		paced = 0;
+		audioPath = NULL;
+	}
+	if (audioPath != NULL && soundDir == NULL) {
+		soundDir = "sounds";
+	}
+	if (soundDir != NULL) {
+		loadSoundBank(soundDir);
+		atexit(freeSoundBank);
+	}
+	if (audioPath != NULL) {
+		if (startAudioRender(audioPath)) {
+			exit(1);
+		}
+		atexit(stopAudioRender);
+	}
+
+	if (capturePath != NULL) {
+		size_t len = strlen(capturePath);
+		capture_kind kind = CAPTURE_PPM;
+		if (len > 4 && strcmp(capturePath + len - 4, ".y4m") == 0) {
+			kind = CAPTURE_Y4M;
+		}
+		if (startCapture(capturePath, kind)) {
+			exit(1);
+		}
+		atexit(stopCapture);
+	}
 
     //state->memory[0] = 0xc3;
     //state->memory[1] = 0;
@@ -804,21 +982,143 @@ int main(int argc, char **argv) {
     //state->memory[0x59d] = 0xc2;
     //state->memory[0x59e] = 0x05;
 
+	if (lockstep) {
+		startLockstep(state);
+		atexit(stopLockstep);
+	}
+	//the reference core can't be rewound, so no reverse execution with -l
+	if (reverseMb != 0 && !lockstep) {
+		if (startCheckpoints(state, reverseMb)) {
+			exit(1);
+		}
+		atexit(stopCheckpoints);
+	}
+
+	//listings are addressed from the start of the program file
+	setListingBase(listingBase >= 0 ? listingBase : cpm ? CPM_TPA : 0);
+	if (listingPath != NULL) {
+		loadListing(listingPath);
+		atexit(freeListing);
+	}
+	if (profilePath != NULL) {
+		startProfile(state, profilePath);
+		atexit(stopProfile);
+	}
+	if (coveragePath != NULL) {
+		startCoverage(coveragePath, listingPath);
+		atexit(stopCoverage);
+	}
+	if (samplePath != NULL) {
+		if (startSampling(state, samplePath, sampleHz)) {
+			exit(1);
+		}
+		atexit(stopSampling);
+	}
+	if (statsPath != NULL) {
+		startStats(statsPath);
+		atexit(stopStats);
+	}
+	if (callsPath != NULL) {
+		startCallGraph(state, callsPath);
+		atexit(stopCallGraph);
+	}
+	if (tracePath != NULL) {
+		if (startTrace(state, tracePath, traceLen)) {
+			exit(1);
+		}
+		atexit(stopTrace);
+	}
+
+	if (paced) {
+		startPacing();
+		atexit(stopPacing);
+	}
+
+	if (turbo) {
+		clock_gettime(CLOCK_MONOTONIC, &runStart);
+		atexit(reportTurbo);
+	}
+	//the debugger runs at full speed between stops and shows stepped
+	//instructions itself, so any breakpoint, watchpoint, -d or -gdb
+	//turns the trace off
+	uint8_t debugging = isStepMode || gdbSpec != NULL || debugActive;
+	isTracing = !turbo && !cpm && !debugging;
+	uint8_t render = capturePath != NULL && renderEvery != 0;
+
+	//last, so the counters cover the run loop and little else
+	if (hwCounters && startHwCounters(&totalInstrs) == 0) {
+		atexit(stopHwCounters);
+	}
+
+	uint32_t frameCycles = 0;
     //while (state->pc < fsize + 100) {
-    while (state->pc < state->memSize) {
-		disassemble((char *)state->memory, state->pc);
-    	emulateOp(state);
+	if (gdbSpec != NULL && startGdbStub(gdbSpec)) {
+		exit(1);
+	}
+	if (isStepMode || gdbSpec != NULL) {
+		requestStop(); //start in the debugger
+	}
+	uint64_t *opCounts = statCounters();
+	uint32_t prevOp = STATS_NO_PREV;
+    while (!state->halted && state->pc < state->memSize) {
+		if (debugActive && debugBefore(state)) {
+			debugStop(state);
+			continue;
+		}
+		if (cpmTraps[state->pc]) {
+			uint16_t trapPc = state->pc;
+			dispatchState = DISPATCH_TRAP;
+			if (checkpointsOn) {
+				checkpointTrap(state);
+			} else {
+				cpmTrap(state);
+			}
+			if (traceOn) traceTrap(state, trapPc);
+			if (lockstep) lockstepSync(state);
+			dispatchState = DISPATCH_CPU;
+			continue;
+		}
+		if (pageHandlersOn) runPageHandlers(state);
+		uint8_t op = state->memory[state->pc];
+		if (isTracing) disassemble((char *)state->memory, state->pc);
+		if (opCounts != NULL) COUNT_OP(opCounts, prevOp, op);
+		if (profilePath != NULL) profileOp(state->pc, opCycles[op]);
+		if (callGraphOn) callGraphOp(opCycles[op]); //charged before a CALL/RET moves frames
+		if (coveragePath != NULL) coverOp(state);
+		if (traceOn) traceBefore(state);
+		if (lockstep) {
+			lockstepOp(state);
+		} else {
+			emulateOp(state);
+		}
+		if (traceOn) traceAfter(state);
         if (DEBUG) printFlags(state);
-        if (isStepMode) {
-			debugPrint(state);
-            //checkOtherState(state);
-			printf("Press [Enter] to continue.\n");
-            //wait for user to hit enter
-			fflush(stdin);
-			getchar();
-        }
+		frameCycles += opCycles[op];
+		totalCycles += opCycles[op];
+		totalInstrs++;
+		if (checkpointsOn) checkpointStep(state);
+		if (frameCycles >= CYCLES_PER_FRAME) {
+			frameCycles -= CYCLES_PER_FRAME;
+			totalFrames++;
+			dispatchState = DISPATCH_FRAME;
+			if (hwCounters) hwCountersFrame();
+			if (render && totalFrames % renderEvery == 0) captureFrame(state);
+			if (audioPath != NULL) renderAudioFrame();
+			if (samplePath != NULL) drainSamples();
+			if (paced) paceFrame();
+			dispatchState = DISPATCH_CPU;
+		}
+		if (debugActive && debugAfter(state)) debugStop(state);
     }
 
+	if (gdbSpec != NULL) stopGdbStub(0);
+	stopHwCounters();
+	stopCoverage();
+	stopProfile();
+	stopSampling();
+	stopCheckpoints();
+	stopTrace();
 	free(buffer);
 	return 0;
 }
+#endif
@@ -7,8 +7,8 @@ void mov(state8080 *state, uint8_t opcode) {
     if (DEBUG) printf("MOV\t");
     int dregno = (opcode >> 3) & 0x07;
     int sregno = opcode & 0x07;
-	printf("dreg: %d", dregno);
-	printf("sreg: %d\n", sregno);
+	if (DEBUG) printf("dreg: %d", dregno);
+	if (DEBUG) printf("sreg: %d\n", sregno);
     register_kind dreg = getRegFromNumber(dregno);
     register_kind sreg = getRegFromNumber(sregno);
     if (DEBUG) printf("%s to %s\n", getRegLabel(state, sreg), getRegLabel(state, dreg));
@@ -52,7 +52,7 @@ void lhld(state8080* state, uint8_t *opcode) {
 	if (DEBUG) printf("LHLD\t");
 	uint16_t addr = (opcode[2] << 8) | opcode[1];
 	if (DEBUG) printf("($%04x)\n", addr);
-	state->h = state->memory[addr + 1];
+	state->h = state->memory[(uint16_t)(addr + 1)];
 	state->l = state->memory[addr];
 }
 
@@ -60,7 +60,7 @@ void shld(state8080* state, uint8_t *opcode) {
 	if (DEBUG) printf("SHLD\t");
 	uint16_t addr = (opcode[2] << 8) | opcode[1];
 	if (DEBUG) printf("($%04x)\n", addr);
-	state->memory[addr + 1] = state->h;
+	state->memory[(uint16_t)(addr + 1)] = state->h;
 	state->memory[addr] = state->l;
 }
 
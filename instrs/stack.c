@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include "../globals.h"
 #include "../util.h"
+#include "../ports.h"
 
 void push(state8080* state, uint8_t opcode) {
     if (DEBUG) printf("PUSH\t");
@@ -9,8 +10,8 @@ void push(state8080* state, uint8_t opcode) {
     registerPair_kind rp = getRPFromNumber(state, rpNo);
     if (DEBUG) printf("%s\n", getRPLabel(state, rpNo));
     uint16_t rpVal = getRPVal(state, rp);
-    state->memory[state->sp - 1] = (uint8_t)(rpVal >> 8);
-    state->memory[state->sp - 2] = (uint8_t)rpVal;
+    state->memory[(uint16_t)(state->sp - 1)] = (uint8_t)(rpVal >> 8);
+    state->memory[(uint16_t)(state->sp - 2)] = (uint8_t)rpVal;
     state->sp -= 2;
 }
 
@@ -19,7 +20,7 @@ void pop(state8080* state, uint8_t opcode) {
     uint8_t rpNo = (opcode >> 4) & 0x03;
     registerPair_kind rp = getRPFromNumber(state, rpNo);
     if (DEBUG) printf("%s\n", getRPLabel(state, rpNo));
-    uint8_t valHi = state->memory[state->sp + 1];
+    uint8_t valHi = state->memory[(uint16_t)(state->sp + 1)];
     uint8_t valLo = state->memory[state->sp];
     setRPVal(state, rp, (valHi << 8) | valLo);
     state->sp += 2;
@@ -27,19 +28,19 @@ void pop(state8080* state, uint8_t opcode) {
 
 void pushPsw(state8080* state) {
     if (DEBUG) printf("PUSH PSW\n");
-    state->memory[state->sp - 1] = state->a;
+    state->memory[(uint16_t)(state->sp - 1)] = state->a;
     uint8_t psw = (state->cc.z |
                     state->cc.s << 1 |
                     state->cc.p << 2 |
                     state->cc.cy << 3 |
                     state->cc.ac << 4 );
-    state->memory[state->sp - 2] = psw;
+    state->memory[(uint16_t)(state->sp - 2)] = psw;
     state->sp -= 2;
 }
 
 void popPsw(state8080* state) {
     if (DEBUG) printf("POP PSW\n");
-    state->a = state->memory[state->sp + 1];
+    state->a = state->memory[(uint16_t)(state->sp + 1)];
     uint8_t psw = state->memory[state->sp];
     state->cc.z  = (0x01 == (psw & 0x01));
     state->cc.s  = (0x02 == (psw & 0x02));
@@ -52,3 +53,18 @@ void popPsw(state8080* state) {
 void sphl(state8080* state) {
     state->sp = (state->h << 8) | state->l;
 }
+
+void in(state8080* state, uint8_t *opcode) {
+    if (DEBUG) printf("IN #$%02x\n", opcode[1]);
+    state->a = readPort(state, opcode[1]);
+}
+
+void out(state8080* state, uint8_t *opcode) {
+    if (DEBUG) printf("OUT #$%02x\n", opcode[1]);
+    writePort(state, opcode[1], state->a);
+}
+
+void hlt(state8080* state) {
+    if (DEBUG) printf("HLT\n");
+    state->halted = 1;
+}
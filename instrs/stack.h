@@ -2,4 +2,7 @@ void push(state8080*, uint8_t);
 void pop(state8080*, uint8_t);
 void pushPsw(state8080*);
 void popPsw(state8080*);
-void sphl(state8080*);
\ No newline at end of file
+void sphl(state8080*);
+void in(state8080*, uint8_t*);
+void out(state8080*, uint8_t*);
+void hlt(state8080*);
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "disassembler.h"
+#include "lockstep.h"
+
+//The tutorial's reference core, compiled only here
+#include "8080emu-first50.c"
+
+void emulateOp(state8080*);
+
+//Lockstep runs emulateOp and the reference Emulate8080Op side by side,
+//each on its own copy of memory, and stops at the first instruction
+//after which registers, flags or memory differ.
+#define PAGE_SIZE 256
+#define PAGES (0x10000 / PAGE_SIZE)
+//a full memory compare catches writes outside the predicted pages
+#define SWEEP_INTERVAL 65536
+
+static State8080 ref;
+static uint8_t *refMemory;
+static uint8_t enabled;
+static uint64_t steps;
+
+void snapshotState(state8080 *state, cpuSnapshot *snap) {
+	memset(snap, 0, sizeof(*snap));
+	snap->pc = state->pc;
+	snap->sp = state->sp;
+	snap->a = state->a; snap->b = state->b; snap->c = state->c;
+	snap->d = state->d; snap->e = state->e; snap->h = state->h; snap->l = state->l;
+	snap->flags = state->cc.z | state->cc.s << 1 | state->cc.p << 2 | state->cc.cy << 3;
+}
+
+static void snapshotRef(State8080 *state, cpuSnapshot *snap) {
+	memset(snap, 0, sizeof(*snap));
+	snap->pc = state->pc;
+	snap->sp = state->sp;
+	snap->a = state->a; snap->b = state->b; snap->c = state->c;
+	snap->d = state->d; snap->e = state->e; snap->h = state->h; snap->l = state->l;
+	snap->flags = state->cc.z | state->cc.s << 1 | state->cc.p << 2 | state->cc.cy << 3;
+}
+
+void restoreState(state8080 *state, cpuSnapshot *snap) {
+	state->pc = snap->pc;
+	state->sp = snap->sp;
+	state->a = snap->a; state->b = snap->b; state->c = snap->c;
+	state->d = snap->d; state->e = snap->e; state->h = snap->h; state->l = snap->l;
+	state->cc.z = snap->flags & 1;
+	state->cc.s = (snap->flags >> 1) & 1;
+	state->cc.p = (snap->flags >> 2) & 1;
+	state->cc.cy = (snap->flags >> 3) & 1;
+	state->cc.ac = 0;
+}
+
+//Run one reference instruction on a register snapshot and memory of
+//the caller's own; safe to use from several threads at once. Returns
+//1 if the reference core doesn't implement the opcode.
+int stepReference(cpuSnapshot *snap, uint8_t *memory) {
+	State8080 st = {0};
+	st.memory = memory;
+	st.pc = snap->pc;
+	st.sp = snap->sp;
+	st.a = snap->a; st.b = snap->b; st.c = snap->c;
+	st.d = snap->d; st.e = snap->e; st.h = snap->h; st.l = snap->l;
+	st.cc.z = snap->flags & 1;
+	st.cc.s = (snap->flags >> 1) & 1;
+	st.cc.p = (snap->flags >> 2) & 1;
+	st.cc.cy = (snap->flags >> 3) & 1;
+	jmp_buf fault;
+	if (setjmp(fault) != 0) {
+		refFaultHandler = NULL;
+		return 1;
+	}
+	refFaultHandler = &fault;
+	Emulate8080Op(&st);
+	refFaultHandler = NULL;
+	snapshotRef(&st, snap);
+	return 0;
+}
+
+//Copy our registers and memory into the reference core
+void lockstepSync(state8080 *state) {
+	if (!enabled) return;
+	ref.a = state->a; ref.b = state->b; ref.c = state->c;
+	ref.d = state->d; ref.e = state->e; ref.h = state->h; ref.l = state->l;
+	ref.sp = state->sp;
+	ref.pc = state->pc;
+	ref.cc.z = state->cc.z;
+	ref.cc.s = state->cc.s;
+	ref.cc.p = state->cc.p;
+	ref.cc.cy = state->cc.cy;
+	ref.cc.ac = state->cc.ac;
+	ref.int_enable = state->int_enable;
+	memset(refMemory, 0, 0x10000);
+	memcpy(refMemory, state->memory, state->memSize);
+}
+
+void startLockstep(state8080 *state) {
+	refMemory = malloc(0x10000);
+	ref.memory = refMemory;
+	enabled = 1;
+	lockstepSync(state);
+}
+
+void stopLockstep(void) {
+	if (refMemory == NULL) return;
+	fprintf(stderr, "lockstep: %llu instructions compared\n", (unsigned long long)steps);
+	free(refMemory);
+	refMemory = NULL;
+	enabled = 0;
+}
+
+static void printSnapshot(const char *name, cpuSnapshot *s) {
+	printf("\t%-9s PC:$%04x SP:$%04x A:$%02x B:$%02x C:$%02x D:$%02x E:$%02x H:$%02x L:$%02x Z:%d S:%d P:%d CY:%d\n",
+			name, s->pc, s->sp, s->a, s->b, s->c, s->d, s->e, s->h, s->l,
+			s->flags & 1, (s->flags >> 1) & 1, (s->flags >> 2) & 1, (s->flags >> 3) & 1);
+}
+
+static void diverged(state8080 *state, uint16_t pc, cpuSnapshot *ours, cpuSnapshot *theirs, int page) {
+	printf("lockstep: cores diverged after %llu instructions at\n", (unsigned long long)steps);
+	printf("\t");
+	disassemble(refMemory, pc);
+	printSnapshot("emulateOp", ours);
+	printSnapshot("reference", theirs);
+	if (page >= 0) {
+		int shown = 0;
+		for (int i = page * PAGE_SIZE; i < (page + 1) * PAGE_SIZE && shown < 16; i++) {
+			if (i < state->memSize && state->memory[i] != refMemory[i]) {
+				printf("\tmem[$%04x]: emulateOp $%02x, reference $%02x\n", i, state->memory[i], refMemory[i]);
+				shown++;
+			}
+		}
+	}
+	exit(1);
+}
+
+static int pageDiffers(state8080 *state, int page) {
+	uint32_t start = page * PAGE_SIZE;
+	if (start >= state->memSize) return 0;
+	uint32_t len = state->memSize - start < PAGE_SIZE ? state->memSize - start : PAGE_SIZE;
+	return memcmp(state->memory + start, refMemory + start, len) != 0;
+}
+
+//Run one instruction on both cores and compare. Only the pages an
+//instruction can write (through HL, BC, DE, the stack or a direct
+//address) are compared each step, with a full sweep now and then.
+void lockstepOp(state8080 *state) {
+	if (!enabled) {
+		emulateOp(state);
+		return;
+	}
+	uint16_t pc = state->pc;
+	//operands wrap like the fetch does, not off the end of memory
+	uint16_t direct = state->memory[(uint16_t)(pc + 1)] | (state->memory[(uint16_t)(pc + 2)] << 8);
+	uint16_t addrs[7] = {
+		(state->h << 8) | state->l, (state->b << 8) | state->c, (state->d << 8) | state->e,
+		state->sp - 1, state->sp - 2, direct, direct + 1
+	};
+
+	jmp_buf fault;
+	if (setjmp(fault) == 0) {
+		refFaultHandler = &fault;
+		Emulate8080Op(&ref);
+	} else {
+		refFaultHandler = NULL;
+		printf("lockstep: reference core can't execute $%02x at $%04x after %llu instructions, continuing without it\n",
+				refMemory[pc], pc, (unsigned long long)steps);
+		stopLockstep();
+		emulateOp(state);
+		return;
+	}
+	refFaultHandler = NULL;
+	emulateOp(state);
+	steps++;
+
+	cpuSnapshot ours, theirs;
+	snapshotState(state, &ours);
+	snapshotRef(&ref, &theirs);
+	if (memcmp(&ours, &theirs, sizeof(ours)) != 0) {
+		diverged(state, pc, &ours, &theirs, -1);
+	}
+	uint8_t checked[PAGES / 8] = {0};
+	for (int i = 0; i < 7; i++) {
+		int page = addrs[i] / PAGE_SIZE;
+		if (checked[page / 8] & (1 << (page % 8))) continue;
+		checked[page / 8] |= 1 << (page % 8);
+		if (pageDiffers(state, page)) diverged(state, pc, &ours, &theirs, page);
+	}
+	if (steps % SWEEP_INTERVAL == 0) {
+		for (int page = 0; page < PAGES; page++) {
+			if (pageDiffers(state, page)) diverged(state, pc, &ours, &theirs, page);
+		}
+	}
+}
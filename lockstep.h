@@ -0,0 +1,16 @@
+//Register file of either core in one comparable layout
+typedef struct cpuSnapshot {
+	uint16_t pc;
+	uint16_t sp;
+	uint8_t a, b, c, d, e, h, l;
+	uint8_t flags; //z s p cy, ac is not implemented by emulateOp
+} cpuSnapshot;
+
+void startLockstep(state8080*);
+void lockstepOp(state8080*);
+void lockstepSync(state8080*);
+void stopLockstep(void);
+
+void snapshotState(state8080*, cpuSnapshot*);
+void restoreState(state8080*, cpuSnapshot*);
+int stepReference(cpuSnapshot*, uint8_t*);
@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include "globals.h"
+#include "memaccess.h"
+
+//Which guest addresses the instruction at PC is about to read or write,
+//worked out from the opcode and the registers before it runs. emulateOp
+//indexes memory directly, so this is how coverage and watchpoints see
+//data accesses without a load/store layer in every handler. Conditional
+//CALLs and RETs only count when they'll be taken.
+
+static int conditionHolds(state8080 *state, uint8_t op) {
+	switch ((op >> 3) & 7) {
+		case 0: return !state->cc.z;
+		case 1: return state->cc.z;
+		case 2: return !state->cc.cy;
+		case 3: return state->cc.cy;
+		case 4: return !state->cc.p;
+		case 5: return state->cc.p;
+		case 6: return !state->cc.s;
+		default: return state->cc.s;
+	}
+}
+
+static int add(memAccess *out, int n, uint16_t addr, uint8_t write) {
+	out[n].addr = addr;
+	out[n].write = write;
+	return n + 1;
+}
+
+int decodeAccesses(state8080 *state, memAccess *out) {
+	uint8_t *code = &state->memory[state->pc];
+	uint8_t op = code[0];
+	uint16_t hl = (state->h << 8) | state->l;
+	uint16_t sp = state->sp;
+	int n = 0;
+
+	if (op >= 0x40 && op < 0x80 && op != 0x76) {
+		//MOV: source M reads, destination M writes
+		if ((op & 7) == 6) n = add(out, n, hl, 0);
+		if ((op & 0x38) == 0x30) n = add(out, n, hl, 1);
+		return n;
+	}
+	if (op >= 0x80 && op < 0xc0) {
+		//ALU ops with M
+		if ((op & 7) == 6) n = add(out, n, hl, 0);
+		return n;
+	}
+	switch (op) {
+		case 0x34: case 0x35: //INR M, DCR M
+			n = add(out, n, hl, 0);
+			return add(out, n, hl, 1);
+		case 0x36: return add(out, n, hl, 1); //MVI M
+		case 0x0a: return add(out, n, (state->b << 8) | state->c, 0);
+		case 0x1a: return add(out, n, (state->d << 8) | state->e, 0);
+		case 0x02: return add(out, n, (state->b << 8) | state->c, 1);
+		case 0x12: return add(out, n, (state->d << 8) | state->e, 1);
+		case 0x3a: return add(out, n, code[1] | (code[2] << 8), 0); //LDA
+		case 0x32: return add(out, n, code[1] | (code[2] << 8), 1); //STA
+		case 0x2a: //LHLD
+			n = add(out, n, code[1] | (code[2] << 8), 0);
+			return add(out, n, (uint16_t)((code[1] | (code[2] << 8)) + 1), 0);
+		case 0x22: //SHLD
+			n = add(out, n, code[1] | (code[2] << 8), 1);
+			return add(out, n, (uint16_t)((code[1] | (code[2] << 8)) + 1), 1);
+		case 0xe3: //XTHL
+			n = add(out, n, sp, 0);
+			n = add(out, n, (uint16_t)(sp + 1), 0);
+			n = add(out, n, sp, 1);
+			return add(out, n, (uint16_t)(sp + 1), 1);
+		case 0xc9: //RET
+			n = add(out, n, sp, 0);
+			return add(out, n, (uint16_t)(sp + 1), 0);
+		case 0xcd: //CALL
+			n = add(out, n, (uint16_t)(sp - 1), 1);
+			return add(out, n, (uint16_t)(sp - 2), 1);
+	}
+	switch (op & 0xcf) {
+		case 0xc5: //PUSH
+			n = add(out, n, (uint16_t)(sp - 1), 1);
+			return add(out, n, (uint16_t)(sp - 2), 1);
+		case 0xc1: //POP
+			n = add(out, n, sp, 0);
+			return add(out, n, (uint16_t)(sp + 1), 0);
+	}
+	switch (op & 0xc7) {
+		case 0xc7: //RST
+			n = add(out, n, (uint16_t)(sp - 1), 1);
+			return add(out, n, (uint16_t)(sp - 2), 1);
+		case 0xc4: //Ccc
+			if (!conditionHolds(state, op)) return 0;
+			n = add(out, n, (uint16_t)(sp - 1), 1);
+			return add(out, n, (uint16_t)(sp - 2), 1);
+		case 0xc0: //Rcc
+			if (!conditionHolds(state, op)) return 0;
+			n = add(out, n, sp, 0);
+			return add(out, n, (uint16_t)(sp + 1), 0);
+	}
+	return 0;
+}
+
+//Page handlers: clients register a callback, then switch it on for the
+//256-byte pages they care about. pageMask says which handlers want a
+//page, so an instruction touching unwatched pages costs one load per
+//access.
+uint8_t pageMask[256];
+uint8_t pageHandlersOn;
+static page_handler handlers[MAX_PAGE_HANDLERS];
+static int handlerCount;
+static int pagesWatched;
+
+int addPageHandler(page_handler handler) {
+	if (handlerCount == MAX_PAGE_HANDLERS) return -1;
+	handlers[handlerCount] = handler;
+	return handlerCount++;
+}
+
+void watchPage(int id, uint8_t page, uint8_t on) {
+	uint8_t bit = 1 << id;
+	if (on && !(pageMask[page] & bit)) {
+		if (pageMask[page] == 0) pagesWatched++;
+		pageMask[page] |= bit;
+	} else if (!on && (pageMask[page] & bit)) {
+		pageMask[page] &= ~bit;
+		if (pageMask[page] == 0) pagesWatched--;
+	}
+	pageHandlersOn = pagesWatched != 0;
+}
+
+void runPageHandlers(state8080 *state) {
+	memAccess accesses[MAX_ACCESSES];
+	int n = decodeAccesses(state, accesses);
+	for (int i = 0; i < n; i++) {
+		uint8_t mask = pageMask[accesses[i].addr >> 8];
+		for (int id = 0; mask; id++, mask >>= 1) {
+			if (mask & 1) handlers[id](state, accesses[i].addr, accesses[i].write);
+		}
+	}
+}
@@ -0,0 +1,21 @@
+//at most XTHL's two reads and two writes
+#define MAX_ACCESSES 4
+
+typedef struct memAccess {
+	uint16_t addr;
+	uint8_t write;
+} memAccess;
+
+int decodeAccesses(state8080*, memAccess*);
+
+//called before the instruction runs, once per access to a watched page
+typedef void (*page_handler)(state8080*, uint16_t, uint8_t);
+
+#define MAX_PAGE_HANDLERS 8
+
+extern uint8_t pageMask[256];
+extern uint8_t pageHandlersOn;
+
+int addPageHandler(page_handler);
+void watchPage(int, uint8_t, uint8_t);
+void runPageHandlers(state8080*);
@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "globals.h"
+#include "sounds.h"
+#include "mixer.h"
+
+#define SAMPLES_PER_FRAME (SAMPLE_RATE / FRAME_HZ)
+
+static FILE *wavOut;
+static uint32_t samplesWritten;
+static int16_t frameBuf[SAMPLES_PER_FRAME];
+
+static int16_t saturate(int32_t x) {
+	if (x > INT16_MAX) return INT16_MAX;
+	if (x < INT16_MIN) return INT16_MIN;
+	return x;
+}
+
+//out[i] = sat(out[i] + src[i])
+static void addSaturating(int16_t *out, const int16_t *src, uint32_t n) {
+	uint32_t i = 0;
+#ifdef __SSE2__
+	for (; i + 8 <= n; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(out + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_adds_epi16(a, b));
+	}
+#endif
+	for (; i < n; i++) {
+		out[i] = saturate((int32_t)out[i] + src[i]);
+	}
+}
+
+//Sum every active voice into out, advancing the voices. Looping voices
+//wrap back to the start of their sample.
+void mixVoices(int16_t *out, uint32_t n) {
+	memset(out, 0, n * sizeof(int16_t));
+	for (int v = 0; v < SOUND_COUNT; v++) {
+		voice *vc = &voices[v];
+		uint32_t done = 0;
+		while (done < n && vc->pos < vc->end) {
+			uint32_t chunk = vc->end - vc->pos;
+			if (chunk > n - done) chunk = n - done;
+			addSaturating(out + done, vc->pos, chunk);
+			vc->pos += chunk;
+			done += chunk;
+			if (vc->pos == vc->end && vc->loop) {
+				vc->pos = vc->start;
+			}
+		}
+	}
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+	p[0] = v; p[1] = v >> 8;
+}
+
+static void writeWavHeader(uint32_t samples) {
+	uint8_t hdr[44];
+	uint32_t dataSize = samples * sizeof(int16_t);
+	memcpy(hdr, "RIFF", 4);
+	put32(hdr + 4, 36 + dataSize);
+	memcpy(hdr + 8, "WAVEfmt ", 8);
+	put32(hdr + 16, 16);
+	put16(hdr + 20, 1); //PCM
+	put16(hdr + 22, 1); //mono
+	put32(hdr + 24, SAMPLE_RATE);
+	put32(hdr + 28, SAMPLE_RATE * sizeof(int16_t));
+	put16(hdr + 32, sizeof(int16_t));
+	put16(hdr + 34, 16);
+	memcpy(hdr + 36, "data", 4);
+	put32(hdr + 40, dataSize);
+	fseek(wavOut, 0L, SEEK_SET);
+	fwrite(hdr, sizeof(hdr), 1, wavOut);
+}
+
+//Offline mode: one frame's worth of audio is mixed per emulated frame
+//and appended to a wav file, so a headless run renders as fast as it
+//emulates rather than in wall-clock time.
+int startAudioRender(const char *path) {
+	wavOut = fopen(path, "wb");
+	if (wavOut == NULL) {
+		printf("Error: Couldn't open %s\n", path);
+		return 1;
+	}
+	setvbuf(wavOut, NULL, _IOFBF, 1 << 20);
+	writeWavHeader(0);
+	return 0;
+}
+
+void renderAudioFrame(void) {
+	if (wavOut == NULL) return;
+	mixVoices(frameBuf, SAMPLES_PER_FRAME);
+	fwrite(frameBuf, sizeof(frameBuf), 1, wavOut);
+	samplesWritten += SAMPLES_PER_FRAME;
+}
+
+void stopAudioRender(void) {
+	if (wavOut == NULL) return;
+	writeWavHeader(samplesWritten);
+	fclose(wavOut);
+	wavOut = NULL;
+}
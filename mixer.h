@@ -0,0 +1,4 @@
+void mixVoices(int16_t*, uint32_t);
+int startAudioRender(const char*);
+void renderAudioFrame(void);
+void stopAudioRender(void);
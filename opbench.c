@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "globals.h"
+#include "util.h"
+
+//Per-opcode microbenchmark. Each opcode is executed on its own, over
+//and over, from a fixed state, and the cost of the harness loop is
+//subtracted. Run it before and after a change to emulateOp or the
+//instrs/ helpers to see which opcodes moved.
+
+void emulateOp(state8080*);
+
+#define CODE 0x0100
+#define DEFAULT_ITERS 2000000
+//flag opcodes this many times slower than the median
+#define OUTLIER_FACTOR 2.0
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static const char *opGroup(uint8_t op) {
+	if (op == 0x76) return "HLT";
+	if (op >= 0x40 && op < 0x80) return (op & 0x07) == 6 || (op & 0x38) == 0x30 ? "MOV M" : "MOV";
+	if (op >= 0x80 && op < 0xc0) return (op & 0x07) == 6 ? "ALU M" : "ALU r";
+	if (op < 0x40) {
+		switch (op & 0x0f) {
+			case 0x01: return "LXI";
+			case 0x03: case 0x0b: return "INX/DCX";
+			case 0x04: case 0x05: case 0x0c: case 0x0d: return "INR/DCR";
+			case 0x06: case 0x0e: return "MVI";
+			case 0x09: return "DAD";
+			case 0x07: case 0x0f: return "rotate/misc";
+			default: return "load/store";
+		}
+	}
+	switch (op & 0x07) {
+		case 0x00: return "Rcc/RET";
+		case 0x01: return "POP/misc";
+		case 0x02: return "Jcc";
+		case 0x03: return "JMP/IO/misc";
+		case 0x04: return "Ccc";
+		case 0x05: return "PUSH/CALL";
+		case 0x06: return "ALU imm";
+		default: return "RST";
+	}
+}
+
+//Every iteration starts from here: operands point at scratch memory
+//well away from the code, and the stack has room both ways.
+static void reset(state8080 *state) {
+	state->pc = CODE;
+	state->sp = 0xf000;
+	state->b = 0x81; state->c = 0x00;
+	state->d = 0x82; state->e = 0x00;
+	state->h = 0x80; state->l = 0x00;
+	state->halted = 0;
+}
+
+static int compareDouble(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+//usage: opbench [-n iterations] [-o output.csv]
+int main(int argc, char **argv) {
+	long iters = DEFAULT_ITERS;
+	const char *outPath = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iters = atol(argv[++i]);
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			outPath = argv[++i];
+		}
+	}
+	FILE *out = outPath ? fopen(outPath, "w") : stdout;
+	if (out == NULL) {
+		printf("Error: Couldn't open %s\n", outPath);
+		exit(1);
+	}
+
+	isTracing = 0;
+	state8080 state1 = {0};
+	state8080 *state = &state1;
+	state->memory = calloc(1, 0x10000);
+	state->memSize = 0x10000;
+
+	//cost of the harness alone
+	double start = now();
+	for (long i = 0; i < iters; i++) {
+		reset(state);
+		__asm__ volatile("" ::: "memory");
+	}
+	double overhead = (now() - start) / iters;
+
+	double ns[256];
+	uint8_t implemented[256];
+	for (int op = 0; op < 256; op++) {
+		state->memory[CODE] = op;
+		state->memory[CODE + 1] = 0x00;
+		state->memory[CODE + 2] = 0x80;
+		jmp_buf fault;
+		implemented[op] = 0;
+		ns[op] = 0;
+		reset(state);
+		if (setjmp(fault) == 0) {
+			faultHandler = &fault;
+			emulateOp(state);
+			implemented[op] = 1;
+		}
+		faultHandler = NULL;
+		if (!implemented[op]) continue;
+
+		start = now();
+		for (long i = 0; i < iters; i++) {
+			reset(state);
+			emulateOp(state);
+		}
+		ns[op] = ((now() - start) / iters - overhead) * 1e9;
+		if (ns[op] < 0) ns[op] = 0;
+	}
+
+	double sorted[256];
+	int n = 0;
+	for (int op = 0; op < 256; op++) {
+		if (implemented[op]) sorted[n++] = ns[op];
+	}
+	qsort(sorted, n, sizeof(double), compareDouble);
+	double median = n ? sorted[n / 2] : 0;
+
+	fprintf(out, "opcode,group,ns_per_instr,flag\n");
+	for (int op = 0; op < 256; op++) {
+		if (!implemented[op]) {
+			fprintf(out, "0x%02x,%s,,unimplemented\n", op, opGroup(op));
+		} else {
+			fprintf(out, "0x%02x,%s,%.2f,%s\n", op, opGroup(op), ns[op],
+					ns[op] > median * OUTLIER_FACTOR ? "outlier" : "");
+		}
+	}
+	fprintf(stderr, "opbench: %d opcodes, median %.2f ns, harness overhead %.2f ns\n",
+			n, median, overhead * 1e9);
+	if (out != stdout) fclose(out);
+	free(state->memory);
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include "globals.h"
+#include "pacing.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define JITTER_BUCKETS 16
+//frames we are allowed to fall behind before giving up on catching up
+#define MAX_LAG_FRAMES 4
+
+//Deadlines are absolute and computed from the frame number, not by
+//adding a rounded period to the last deadline, so error never builds up.
+static struct timespec base;
+static uint64_t framesSinceBase;
+static uint64_t resyncs;
+//bucket i counts wakeups that were late by [2^(i-1), 2^i) microseconds
+static uint64_t jitter[JITTER_BUCKETS];
+
+static uint64_t toNs(struct timespec *t) {
+	return (uint64_t)t->tv_sec * NSEC_PER_SEC + t->tv_nsec;
+}
+
+static struct timespec fromNs(uint64_t ns) {
+	struct timespec t = {ns / NSEC_PER_SEC, ns % NSEC_PER_SEC};
+	return t;
+}
+
+void startPacing(void) {
+	clock_gettime(CLOCK_MONOTONIC, &base);
+	framesSinceBase = 0;
+}
+
+//Sleep until the end of the current frame.
+void paceFrame(void) {
+	framesSinceBase++;
+	uint64_t deadline = toNs(&base) + framesSinceBase * NSEC_PER_SEC / FRAME_HZ;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (toNs(&now) > deadline + MAX_LAG_FRAMES * NSEC_PER_SEC / FRAME_HZ) {
+		//too far behind (stopped in a debugger, host overloaded): restart
+		//the schedule from now instead of running flat out to catch up
+		resyncs++;
+		base = now;
+		framesSinceBase = 0;
+		return;
+	}
+	struct timespec ts = fromNs(deadline);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t lateUs = toNs(&now) > deadline ? (toNs(&now) - deadline) / 1000 : 0;
+	int bucket = 0;
+	while (lateUs && bucket < JITTER_BUCKETS - 1) {
+		lateUs >>= 1;
+		bucket++;
+	}
+	jitter[bucket]++;
+}
+
+void stopPacing(void) {
+	fprintf(stderr, "pacing: frame wakeup jitter (%llu resyncs)\n", (unsigned long long)resyncs);
+	for (int i = 0; i < JITTER_BUCKETS; i++) {
+		if (jitter[i] == 0) continue;
+		if (i == 0) {
+			fprintf(stderr, "\t     <1us: %llu\n", (unsigned long long)jitter[i]);
+		} else if (i == JITTER_BUCKETS - 1) {
+			fprintf(stderr, "\t>=%6uus: %llu\n", 1u << (i - 1), (unsigned long long)jitter[i]);
+		} else {
+			fprintf(stderr, "\t<%7uus: %llu\n", 1u << i, (unsigned long long)jitter[i]);
+		}
+	}
+}
@@ -0,0 +1,3 @@
+void startPacing(void);
+void paceFrame(void);
+void stopPacing(void);
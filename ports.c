@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "globals.h"
+#include "ports.h"
+#include "sounds.h"
+
+//Space Invaders i/o: a hardware shift register on ports 2/3/4 and
+//sound latches on ports 3 and 5. Sounds start on the rising edge of
+//their latch bit; the UFO loops until its bit drops. Ports 0-2 read
+//back whatever the player inputs were last set to.
+static portState ports;
+
+static const sound_kind port3Sounds[5] = {
+	SOUND_UFO, SOUND_SHOT, SOUND_BASEHIT, SOUND_INVHIT, SOUND_EXTRALIFE
+};
+static const sound_kind port5Sounds[5] = {
+	SOUND_WALK1, SOUND_WALK2, SOUND_WALK3, SOUND_WALK4, SOUND_UFOHIT
+};
+
+static void latchSounds(uint8_t *latch, uint8_t val, const sound_kind *sounds, uint8_t loopMask) {
+	uint8_t rising = val & ~*latch;
+	uint8_t falling = *latch & ~val;
+	for (int bit = 0; bit < 5; bit++) {
+		uint8_t mask = 1 << bit;
+		if (rising & mask) {
+			startSound(sounds[bit], (loopMask & mask) != 0);
+		} else if ((falling & mask) && (loopMask & mask)) {
+			stopSound(sounds[bit]);
+		}
+	}
+	*latch = val;
+}
+
+uint8_t readPort(state8080 *state, uint8_t port) {
+	switch (port) {
+		case 0:
+		case 1:
+		case 2:
+			return ports.inputs[port];
+		case 3:
+			return (ports.shiftReg >> (8 - ports.shiftOffset)) & 0xff;
+		default:
+			return 0;
+	}
+}
+
+void writePort(state8080 *state, uint8_t port, uint8_t val) {
+	switch (port) {
+		case 2:
+			ports.shiftOffset = val & 0x07;
+			break;
+		case 3:
+			latchSounds(&ports.latch3, val, port3Sounds, 0x01);
+			break;
+		case 4:
+			ports.shiftReg = (val << 8) | (ports.shiftReg >> 8);
+			break;
+		case 5:
+			latchSounds(&ports.latch5, val, port5Sounds, 0x00);
+			break;
+		default:
+			break;
+	}
+}
+
+void setInputPort(uint8_t port, uint8_t val) {
+	if (port < 3) ports.inputs[port] = val;
+}
+
+//Back to power-on state, for harnesses that run many short sessions
+void resetPorts(void) {
+	memset(&ports, 0, sizeof(ports));
+}
+
+//For checkpoints; restoring doesn't replay sound edges
+void savePorts(portState *out) {
+	*out = ports;
+}
+
+void restorePorts(const portState *in) {
+	ports = *in;
+}
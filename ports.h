@@ -0,0 +1,14 @@
+typedef struct portState {
+	uint8_t inputs[3];
+	uint16_t shiftReg;
+	uint8_t shiftOffset;
+	uint8_t latch3;
+	uint8_t latch5;
+} portState;
+
+uint8_t readPort(state8080*, uint8_t);
+void writePort(state8080*, uint8_t, uint8_t);
+void setInputPort(uint8_t, uint8_t);
+void resetPorts(void);
+void savePorts(portState*);
+void restorePorts(const portState*);
@@ -0,0 +1,231 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "globals.h"
+#include "profile.h"
+
+//Guest hot-spot profiler. Execution counts and cycles are kept in flat
+//arrays indexed by PC. The report groups addresses into functions, each
+//running from a CALL or RST target (or the entry point) up to the next
+//one, and names them from a listing when one was given.
+static uint64_t counts[0x10000];
+static uint64_t cycles[0x10000];
+static state8080 *profiled;
+static uint16_t entryPc;
+static const char *reportPath;
+static char *labels[0x10000];
+static char *listing[0x10000];
+static uint16_t listingBase;
+
+#define TOP_ADDRESSES 40
+#define SWEEP_REACH 64
+
+void profileOp(uint16_t pc, uint8_t opCycles) {
+	counts[pc]++;
+	cycles[pc] += opCycles;
+}
+
+static int isHex(const char *s, int n) {
+	for (int i = 0; i < n; i++) {
+		if (!isxdigit((unsigned char)s[i])) return 0;
+	}
+	return 1;
+}
+
+//Where the listing's address 0000 sits in guest memory. test.asm is
+//addressed by file offset, so under -cpm it starts at CPM_TPA.
+void setListingBase(uint16_t base) {
+	listingBase = base;
+}
+
+//Guest address of a listing line that starts with one, else -1
+int listingAddress(const char *line) {
+	if (!isHex(line, 4) || strchr(" \t\r\n", line[4]) == NULL) return -1;
+	return (uint16_t)(strtol(line, NULL, 16) + listingBase);
+}
+
+//Listing lines look like test.asm: "01ab\tc3\tJMP\t\t$01ab". A line with
+//a word ending in ':' labels its own address, or the next one if it has
+//no address of its own.
+void loadListing(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "profile: couldn't open listing %s\n", path);
+		return;
+	}
+	char line[256];
+	char *pending = NULL;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		char *text = line;
+		int addr = listingAddress(line);
+		if (addr >= 0) text = line + 4;
+		while (*text == ' ' || *text == '\t') text++;
+		char *colon = strchr(text, ':');
+		if (colon != NULL && colon > text && strcspn(text, " \t") == (size_t)(colon - text)) {
+			free(pending);
+			pending = strndup(text, colon - text);
+			text = colon + 1;
+			while (*text == ' ' || *text == '\t') text++;
+		}
+		if (addr < 0) continue;
+		if (pending != NULL) {
+			free(labels[addr]);
+			labels[addr] = pending;
+			pending = NULL;
+		}
+		if (*text != '\0' && listing[addr] == NULL) {
+			listing[addr] = strdup(text);
+		}
+	}
+	free(pending);
+	fclose(f);
+}
+
+static int isCall(uint8_t op) {
+	return op == 0xcd || (op & 0xc7) == 0xc4;
+}
+
+static int isRst(uint8_t op) {
+	return (op & 0xc7) == 0xc7;
+}
+
+typedef struct function {
+	uint16_t entry;
+	uint64_t count;
+	uint64_t cost;
+} function;
+
+static int byCost(const void *a, const void *b) {
+	uint64_t x = ((const function *)a)->cost, y = ((const function *)b)->cost;
+	return (x < y) - (x > y);
+}
+
+static const uint64_t *sortCost;
+
+static int addrByCost(const void *a, const void *b) {
+	uint64_t x = sortCost[*(const uint16_t *)a], y = sortCost[*(const uint16_t *)b];
+	return (x < y) - (x > y);
+}
+
+void functionName(uint16_t entry, char *out, size_t size) {
+	if (labels[entry] != NULL) {
+		snprintf(out, size, "%s", labels[entry]);
+	} else {
+		snprintf(out, size, "sub_%04x", entry);
+	}
+}
+
+//sweep: sampled counts miss most CALLs, so also take any CALL in memory
+//whose target has samples in the SWEEP_REACH bytes from it
+void writeProfileReport(FILE *out, state8080 *state, uint16_t entry, const uint64_t *count, const uint64_t *cost, const char *costName, uint8_t sweep) {
+	//function entries: the entry point, labels, and every CALL or RST
+	//target reached from executed code
+	static uint8_t isEntry[0x10000];
+	memset(isEntry, 0, sizeof(isEntry));
+	isEntry[entry] = 1;
+	uint64_t totalCount = 0, totalCost = 0;
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		if (labels[pc] != NULL) isEntry[pc] = 1;
+		if (count[pc] == 0) continue;
+		totalCount += count[pc];
+		totalCost += cost[pc];
+		uint8_t op = state->memory[pc];
+		if (isCall(op) && pc + 2 < state->memSize) {
+			isEntry[state->memory[pc + 1] | (state->memory[pc + 2] << 8)] = 1;
+		} else if (isRst(op)) {
+			isEntry[op & 0x38] = 1;
+		}
+	}
+	static uint16_t nextCounted[0x10001];
+	nextCounted[0x10000] = 0xffff;
+	for (int32_t pc = 0xffff; sweep && pc >= 0; pc--) {
+		nextCounted[pc] = count[pc] != 0 ? 0 : (nextCounted[pc + 1] == 0xffff ? 0xffff : nextCounted[pc + 1] + 1);
+	}
+	for (uint32_t pc = 0; sweep && pc + 2 < state->memSize; pc++) {
+		uint16_t target = state->memory[pc + 1] | (state->memory[pc + 2] << 8);
+		if (isCall(state->memory[pc]) && nextCounted[target] < SWEEP_REACH) isEntry[target] = 1;
+	}
+
+	function *functions = calloc(0x10000, sizeof(function));
+	uint16_t *owner = malloc(0x10000 * sizeof(uint16_t));
+	int nfunctions = 0;
+	int current = -1;
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		if (isEntry[pc]) {
+			current = nfunctions++;
+			functions[current].entry = pc;
+		}
+		owner[pc] = current < 0 ? 0 : functions[current].entry;
+		if (current < 0 || count[pc] == 0) continue;
+		functions[current].count += count[pc];
+		functions[current].cost += cost[pc];
+	}
+	qsort(functions, nfunctions, sizeof(function), byCost);
+
+	char name[64];
+	fprintf(out, "# %llu counted, %llu %s\n",
+			(unsigned long long)totalCount, (unsigned long long)totalCost, costName);
+	fprintf(out, "\n# functions by %s\n", costName);
+	fprintf(out, "%12s %6s %12s  %-5s %s\n", costName, "%", "count", "entry", "function");
+	for (int i = 0; i < nfunctions && functions[i].cost > 0; i++) {
+		functionName(functions[i].entry, name, sizeof(name));
+		fprintf(out, "%12llu %6.2f %12llu  $%04x %s\n",
+				(unsigned long long)functions[i].cost, 100.0 * functions[i].cost / totalCost,
+				(unsigned long long)functions[i].count, functions[i].entry, name);
+	}
+
+	uint16_t *hot = malloc(0x10000 * sizeof(uint16_t));
+	int nhot = 0;
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		if (cost[pc] > 0) hot[nhot++] = pc;
+	}
+	sortCost = cost;
+	qsort(hot, nhot, sizeof(uint16_t), addrByCost);
+	fprintf(out, "\n# hottest addresses\n");
+	fprintf(out, "%12s %6s %12s  %-5s %-20s %s\n", costName, "%", "count", "addr", "function", "instruction");
+	for (int i = 0; i < nhot && i < TOP_ADDRESSES; i++) {
+		uint16_t pc = hot[i];
+		char where[96];
+		functionName(owner[pc], name, sizeof(name));
+		snprintf(where, sizeof(where), "%s+%x", name, pc - owner[pc]);
+		char opText[8];
+		snprintf(opText, sizeof(opText), "%02x", state->memory[pc]);
+		fprintf(out, "%12llu %6.2f %12llu  $%04x %-20s %s\n",
+				(unsigned long long)cost[pc], 100.0 * cost[pc] / totalCost, (unsigned long long)count[pc],
+				pc, where, listing[pc] != NULL ? listing[pc] : opText);
+	}
+	free(hot);
+	free(owner);
+	free(functions);
+}
+
+void freeListing(void) {
+	for (int i = 0; i < 0x10000; i++) {
+		free(labels[i]);
+		free(listing[i]);
+		labels[i] = listing[i] = NULL;
+	}
+}
+
+int startProfile(state8080 *state, const char *path) {
+	profiled = state;
+	entryPc = state->pc;
+	reportPath = path;
+	return 0;
+}
+
+void stopProfile(void) {
+	if (profiled == NULL) return;
+	FILE *out = fopen(reportPath, "w");
+	if (out == NULL) {
+		fprintf(stderr, "profile: couldn't write %s\n", reportPath);
+	} else {
+		writeProfileReport(out, profiled, entryPc, counts, cycles, "cycles", 0);
+		fclose(out);
+		fprintf(stderr, "profile: report written to %s\n", reportPath);
+	}
+	profiled = NULL;
+}
@@ -0,0 +1,9 @@
+void setListingBase(uint16_t);
+int listingAddress(const char*);
+void loadListing(const char*);
+void freeListing(void);
+void functionName(uint16_t, char*, size_t);
+int startProfile(state8080*, const char*);
+void profileOp(uint16_t, uint8_t);
+void writeProfileReport(FILE*, state8080*, uint16_t, const uint64_t*, const uint64_t*, const char*, uint8_t);
+void stopProfile(void);
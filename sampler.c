@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include "globals.h"
+#include "profile.h"
+#include "sampler.h"
+
+//The name timer_create(2) documents; older glibc headers lack it
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+//Sampling profiler. A CPU-time timer aimed at the emulating thread
+//interrupts it at the chosen rate; the handler only copies the guest
+//PC and what the run loop is doing into a lock-free ring. The run loop
+//drains the ring once a frame into the same flat per-PC arrays the full
+//profiler uses, and the report is the full profiler's, in samples.
+volatile sig_atomic_t dispatchState;
+
+#define RING_SIZE 0x10000 //samples, power of two
+
+typedef struct sample {
+	uint16_t pc;
+	uint8_t dispatch;
+} sample;
+
+static sample ring[RING_SIZE];
+static _Atomic uint32_t head; //written by the handler only
+static _Atomic uint32_t tail; //written by drainSamples only
+static _Atomic uint32_t dropped;
+static state8080 *volatile sampled;
+static uint16_t entryPc;
+static timer_t timer;
+static const char *reportPath;
+static uint64_t samples[0x10000];
+static uint64_t byDispatch[DISPATCH_COUNT];
+
+static const char *dispatchNames[DISPATCH_COUNT] = {"cpu", "trap", "frame"};
+
+static void onSample(int sig, siginfo_t *info, void *context) {
+	state8080 *state = sampled;
+	if (state == NULL) return;
+	uint32_t h = atomic_load_explicit(&head, memory_order_relaxed);
+	if (h - atomic_load_explicit(&tail, memory_order_acquire) == RING_SIZE) {
+		atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+		return;
+	}
+	ring[h & (RING_SIZE - 1)] = (sample){state->pc, dispatchState};
+	atomic_store_explicit(&head, h + 1, memory_order_release);
+}
+
+void drainSamples(void) {
+	uint32_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+	uint32_t h = atomic_load_explicit(&head, memory_order_acquire);
+	for (; t != h; t++) {
+		sample *s = &ring[t & (RING_SIZE - 1)];
+		samples[s->pc]++;
+		byDispatch[s->dispatch]++;
+	}
+	atomic_store_explicit(&tail, t, memory_order_release);
+}
+
+int startSampling(state8080 *state, const char *path, uint32_t hz) {
+	if (hz == 0) hz = 1;
+	reportPath = path;
+	entryPc = state->pc;
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = onSample;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPROF, &sa, NULL) != 0) {
+		perror("sampler: sigaction");
+		return 1;
+	}
+	//thread CPU time, delivered to this thread, so the capture and
+	//audio threads neither get sampled nor take the signal
+	struct sigevent sev;
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGPROF;
+	sev.sigev_notify_thread_id = syscall(SYS_gettid);
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer) != 0) {
+		perror("sampler: timer_create");
+		return 1;
+	}
+	sampled = state;
+	long ns = 1000000000L / hz;
+	struct itimerspec its = {{ns / 1000000000L, ns % 1000000000L}, {ns / 1000000000L, ns % 1000000000L}};
+	if (timer_settime(timer, 0, &its, NULL) != 0) {
+		perror("sampler: timer_settime");
+		timer_delete(timer);
+		sampled = NULL;
+		return 1;
+	}
+	return 0;
+}
+
+void stopSampling(void) {
+	if (sampled == NULL) return;
+	timer_delete(timer);
+	state8080 *state = sampled;
+	sampled = NULL;
+	drainSamples();
+
+	uint64_t total = 0;
+	for (int i = 0; i < DISPATCH_COUNT; i++) total += byDispatch[i];
+	FILE *out = fopen(reportPath, "w");
+	if (out == NULL) {
+		fprintf(stderr, "sampler: couldn't write %s\n", reportPath);
+	} else {
+		writeProfileReport(out, state, entryPc, samples, samples, "samples", 1);
+		fclose(out);
+	}
+	fprintf(stderr, "sampler: %llu samples (%u dropped) written to %s\n",
+			(unsigned long long)total, atomic_load(&dropped), reportPath);
+	for (int i = 0; i < DISPATCH_COUNT && total; i++) {
+		fprintf(stderr, "\t%-6s %6.2f%%\n", dispatchNames[i], 100.0 * byDispatch[i] / total);
+	}
+}
@@ -0,0 +1,8 @@
+//what the run loop is doing, as seen by a sample
+typedef enum {DISPATCH_CPU, DISPATCH_TRAP, DISPATCH_FRAME, DISPATCH_COUNT} dispatch_kind;
+
+extern volatile sig_atomic_t dispatchState;
+
+int startSampling(state8080*, const char*, uint32_t);
+void drainSamples(void);
+void stopSampling(void);
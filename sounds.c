@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sounds.h"
+
+static const char *soundFiles[SOUND_COUNT] = {
+	"ufo.wav", "shot.wav", "basehit.wav", "invhit.wav", "extralife.wav",
+	"walk1.wav", "walk2.wav", "walk3.wav", "walk4.wav", "ufohit.wav",
+	"beginplay.wav", "coin.wav"
+};
+
+//All samples live back to back in one arena as mono int16 at SAMPLE_RATE
+static int16_t *arena;
+static uint32_t sampleStart[SOUND_COUNT];
+static uint32_t sampleLen[SOUND_COUNT];
+
+voice voices[SOUND_COUNT];
+
+typedef struct wavInfo {
+	uint8_t *file;
+	uint8_t *data;
+	uint32_t frames;
+	uint32_t rate;
+	uint16_t channels;
+	uint16_t bits;
+} wavInfo;
+
+static uint32_t le32(uint8_t *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t le16(uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+//Read a RIFF/WAVE PCM file. Anything missing, malformed or unsupported
+//leaves frames at 0 so the sound is simply silent. A short data chunk
+//is clamped to what is actually in the file.
+static void parseWav(const char *path, wavInfo *wav) {
+	memset(wav, 0, sizeof(*wav));
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "sound: couldn't open %s\n", path);
+		return;
+	}
+	fseek(f, 0L, SEEK_END);
+	long fsize = ftell(f);
+	fseek(f, 0L, SEEK_SET);
+	if (fsize < 12) {
+		fprintf(stderr, "sound: %s is empty\n", path);
+		fclose(f);
+		return;
+	}
+	wav->file = malloc(fsize);
+	fsize = fread(wav->file, 1, fsize, f);
+	fclose(f);
+
+	uint8_t *p = wav->file;
+	if (fsize < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4)) {
+		fprintf(stderr, "sound: %s is not a wav file\n", path);
+		return;
+	}
+	long pos = 12;
+	uint16_t format = 0;
+	while (pos + 8 <= fsize) {
+		uint32_t size = le32(p + pos + 4);
+		uint8_t *body = p + pos + 8;
+		long avail = fsize - (pos + 8);
+		if (memcmp(p + pos, "fmt ", 4) == 0 && avail >= 16) {
+			format = le16(body);
+			wav->channels = le16(body + 2);
+			wav->rate = le32(body + 4);
+			wav->bits = le16(body + 14);
+		} else if (memcmp(p + pos, "data", 4) == 0) {
+			if (size > avail) {
+				fprintf(stderr, "sound: %s is truncated\n", path);
+				size = avail;
+			}
+			wav->data = body;
+			if (format == 1 && wav->channels > 0 && wav->rate > 0
+					&& (wav->bits == 8 || wav->bits == 16)) {
+				wav->frames = size / (wav->channels * (wav->bits / 8));
+			} else {
+				fprintf(stderr, "sound: %s is not 8 or 16 bit PCM\n", path);
+			}
+			break;
+		}
+		pos += 8 + size + (size & 1);
+	}
+	if (wav->data == NULL) {
+		fprintf(stderr, "sound: %s has no data\n", path);
+	}
+}
+
+static int16_t wavFrame(wavInfo *wav, uint32_t i) {
+	int32_t sum = 0;
+	for (int ch = 0; ch < wav->channels; ch++) {
+		uint32_t idx = i * wav->channels + ch;
+		if (wav->bits == 8) {
+			sum += ((int16_t)wav->data[idx] - 0x80) * 256;
+		} else {
+			sum += (int16_t)le16(wav->data + idx * 2);
+		}
+	}
+	return sum / wav->channels;
+}
+
+static uint32_t resampledLen(wavInfo *wav) {
+	if (wav->frames == 0) return 0;
+	return (uint64_t)wav->frames * SAMPLE_RATE / wav->rate;
+}
+
+//Linear interpolation from the file's rate to SAMPLE_RATE
+static void convert(wavInfo *wav, int16_t *dst, uint32_t len) {
+	for (uint32_t i = 0; i < len; i++) {
+		uint64_t fixed = ((uint64_t)i * wav->rate << 16) / SAMPLE_RATE;
+		uint32_t j = fixed >> 16;
+		int32_t frac = fixed & 0xffff;
+		int32_t s0 = wavFrame(wav, j);
+		int32_t s1 = j + 1 < wav->frames ? wavFrame(wav, j + 1) : s0;
+		dst[i] = s0 + (((s1 - s0) * frac) >> 16);
+	}
+}
+
+int loadSoundBank(const char *dir) {
+	wavInfo wavs[SOUND_COUNT];
+	char path[1024];
+	uint32_t total = 0;
+	for (int i = 0; i < SOUND_COUNT; i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, soundFiles[i]);
+		parseWav(path, &wavs[i]);
+		sampleStart[i] = total;
+		sampleLen[i] = resampledLen(&wavs[i]);
+		total += sampleLen[i];
+	}
+	arena = malloc((total ? total : 1) * sizeof(int16_t));
+	for (int i = 0; i < SOUND_COUNT; i++) {
+		convert(&wavs[i], arena + sampleStart[i], sampleLen[i]);
+		free(wavs[i].file);
+		voices[i].start = voices[i].pos = voices[i].end = arena + sampleStart[i];
+	}
+	return arena == NULL;
+}
+
+void freeSoundBank(void) {
+	free(arena);
+	arena = NULL;
+	memset(voices, 0, sizeof(voices));
+}
+
+void startSound(sound_kind sound, uint8_t loop) {
+	if (arena == NULL) return;
+	voices[sound].start = voices[sound].pos = arena + sampleStart[sound];
+	voices[sound].end = voices[sound].pos + sampleLen[sound];
+	voices[sound].loop = loop;
+}
+
+void stopSound(sound_kind sound) {
+	voices[sound].loop = 0;
+	voices[sound].pos = voices[sound].end;
+}
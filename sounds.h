@@ -0,0 +1,24 @@
+//Output format every sample is converted to at load time
+#define SAMPLE_RATE 44100
+
+typedef enum {
+	SOUND_UFO, SOUND_SHOT, SOUND_BASEHIT, SOUND_INVHIT, SOUND_EXTRALIFE,
+	SOUND_WALK1, SOUND_WALK2, SOUND_WALK3, SOUND_WALK4, SOUND_UFOHIT,
+	SOUND_BEGINPLAY, SOUND_COIN,
+	SOUND_COUNT
+} sound_kind;
+
+//A playing sound is just a cursor into the preconverted arena
+typedef struct voice {
+	const int16_t *start;
+	const int16_t *pos;
+	const int16_t *end;
+	uint8_t loop;
+} voice;
+
+extern voice voices[SOUND_COUNT];
+
+int loadSoundBank(const char*);
+void freeSoundBank(void);
+void startSound(sound_kind, uint8_t);
+void stopSound(sound_kind);
@@ -0,0 +1,115 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "stats.h"
+
+//Opcode and opcode-pair frequencies. Each thread's run loop counts
+//into its own array, found through a thread-local pointer once per
+//run, so the hot path takes no locks and shares no cache lines; the
+//arrays are chained on a list and summed when the stats are written.
+//Only pairs are counted: a run's first instruction goes in the extra
+//row NO_PREV, and opcode counts are the column sums.
+uint8_t statsOn;
+
+#define NO_PREV 256
+
+typedef struct opStats {
+	uint64_t pairs[(NO_PREV + 1) * 256];
+	struct opStats *next;
+} opStats;
+
+static _Thread_local opStats *threadStats;
+static opStats *allStats;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static const char *statsPath;
+
+static opStats *newThreadStats(void) {
+	opStats *s = calloc(1, sizeof(opStats));
+	pthread_mutex_lock(&statsLock);
+	s->next = allStats;
+	allStats = s;
+	pthread_mutex_unlock(&statsLock);
+	threadStats = s;
+	return s;
+}
+
+void startStats(const char *path) {
+	statsPath = path;
+	if (threadStats == NULL) newThreadStats(); //keep the allocation out of the run
+	statsOn = 1;
+}
+
+//This thread's counters for COUNT_OP, NULL when stats are off
+uint64_t *statCounters(void) {
+	if (!statsOn) return NULL;
+	if (threadStats == NULL) newThreadStats();
+	return threadStats->pairs;
+}
+
+typedef struct statRow {
+	uint16_t key; //opcode, or first << 8 | second for pairs
+	uint64_t count;
+} statRow;
+
+static int byCount(const void *a, const void *b) {
+	uint64_t x = ((const statRow *)a)->count, y = ((const statRow *)b)->count;
+	return (x < y) - (x > y);
+}
+
+//CSV: kind,opcode,next,count,share, opcodes first then pairs, each
+//sorted by count
+void stopStats(void) {
+	if (!statsOn) return;
+	statsOn = 0;
+	opStats *total = calloc(1, sizeof(opStats));
+	uint64_t ops[256] = {0};
+	pthread_mutex_lock(&statsLock);
+	for (opStats *s = allStats; s != NULL; s = s->next) {
+		for (int i = 0; i < (NO_PREV + 1) * 256; i++) {
+			total->pairs[i] += s->pairs[i];
+			ops[i & 0xff] += s->pairs[i];
+		}
+	}
+	while (allStats != NULL) {
+		opStats *s = allStats;
+		allStats = s->next;
+		free(s);
+	}
+	pthread_mutex_unlock(&statsLock);
+
+	FILE *out = fopen(statsPath, "w");
+	if (out == NULL) {
+		fprintf(stderr, "stats: couldn't write %s\n", statsPath);
+		free(total);
+		return;
+	}
+	statRow *rows = malloc(0x10000 * sizeof(statRow));
+	uint64_t instrs = 0, pairs = 0;
+	int n = 0;
+	for (int i = 0; i < 256; i++) {
+		instrs += ops[i];
+		if (ops[i]) rows[n++] = (statRow){i, ops[i]};
+	}
+	qsort(rows, n, sizeof(statRow), byCount);
+	fprintf(out, "kind,opcode,next,count,share\n");
+	for (int i = 0; i < n; i++) {
+		fprintf(out, "op,%02x,,%llu,%.6f\n", rows[i].key,
+				(unsigned long long)rows[i].count, (double)rows[i].count / instrs);
+	}
+	n = 0;
+	for (int i = 0; i < 0x10000; i++) {
+		pairs += total->pairs[i];
+		if (total->pairs[i]) rows[n++] = (statRow){i, total->pairs[i]};
+	}
+	qsort(rows, n, sizeof(statRow), byCount);
+	for (int i = 0; i < n; i++) {
+		fprintf(out, "pair,%02x,%02x,%llu,%.6f\n", rows[i].key >> 8, rows[i].key & 0xff,
+				(unsigned long long)rows[i].count, (double)rows[i].count / pairs);
+	}
+	fclose(out);
+	free(rows);
+	free(total);
+	fprintf(stderr, "stats: %llu instructions, opcode and pair counts written to %s\n",
+			(unsigned long long)instrs, statsPath);
+}
@@ -0,0 +1,14 @@
+extern uint8_t statsOn;
+
+//A run loop that counts fetches its thread's counters once, before it
+//starts, and keeps them and the previous opcode in locals, so counting
+//is one increment. Each run's first opcode pairs with STATS_NO_PREV.
+#define STATS_NO_PREV (256 << 8)
+#define COUNT_OP(counts, prev, op) do { \
+	(counts)[(prev) | (op)]++; \
+	(prev) = (op) << 8; \
+} while (0)
+
+void startStats(const char*);
+uint64_t *statCounters(void);
+void stopStats(void);
@@ -0,0 +1,205 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "globals.h"
+#include "memaccess.h"
+#include "trace.h"
+
+//Binary execution trace. Every instruction becomes one 16-byte record
+//in a ring buffer: PC, opcode and operand bytes, the flags after it,
+//only the registers it changed and the bytes it wrote. No instruction
+//changes more than four bytes of registers (XCHG; POP is a pair plus
+//SP) or writes more than two, so the record has a fixed size; if one
+//ever did, a keyframe follows it. Keyframes carry the whole register
+//file. One is written every KEYFRAME_EVERY records, after each CP/M
+//trap, which changes state wholesale, and whenever the debugger, gdb or
+//a reverse step may have changed state between records, so a decoder
+//can pick up from any point once the ring has wrapped. The ring goes to the file at exit, on
+//a fatal signal, on SIGUSR1 and from the debugger's t command.
+//
+//A record is built aside and joins the ring only once its instruction
+//has finished, so an exit from inside one (an unimplemented opcode)
+//leaves no half-filled record behind. A trap keyframe carries only the
+//registers: what BDOS or the BIOS wrote to an FCB, the dma buffer or a
+//disk sector isn't recorded.
+uint8_t traceOn;
+
+#define KEYFRAME_EVERY 256
+
+static traceRecord *ring;
+static uint64_t ringMask;
+static uint64_t written;
+static traceRecord pending;
+static state8080 before;
+static char tracePath[256];
+static volatile sig_atomic_t flushWanted;
+
+static const size_t regOffsets[7] = {
+	offsetof(state8080, a), offsetof(state8080, b), offsetof(state8080, c), offsetof(state8080, d),
+	offsetof(state8080, e), offsetof(state8080, h), offsetof(state8080, l)
+};
+
+static uint8_t packFlags(state8080 *state) {
+	return state->cc.z | (state->cc.s << 1) | (state->cc.p << 2) | (state->cc.cy << 3);
+}
+
+static traceRecord *nextRecord(void) {
+	return &ring[written++ & ringMask];
+}
+
+static void keyframe(state8080 *state, uint8_t kind, uint16_t trapPc) {
+	traceKeyframe *k = (traceKeyframe *)nextRecord();
+	memset(k, 0, sizeof(*k));
+	k->pc = state->pc;
+	k->sp = state->sp;
+	k->info = TRACE_KEYFRAME | kind | packFlags(state);
+	for (int i = 0; i < 7; i++) k->regs[i] = ((uint8_t *)state)[regOffsets[i]];
+	k->trapPc = trapPc;
+}
+
+//write() only, so the fatal signal handler can use it
+static void writeAll(int fd, const void *data, size_t len) {
+	const char *p = data;
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n <= 0) return;
+		p += n;
+		len -= n;
+	}
+}
+
+static void writeRing(void) {
+	int fd = open(tracePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return;
+	uint64_t size = ringMask + 1;
+	uint64_t count = written < size ? written : size;
+	traceHeader header = {TRACE_MAGIC, TRACE_VERSION, sizeof(traceRecord), written - count, count};
+	writeAll(fd, &header, sizeof(header));
+	uint64_t start = (written - count) & ringMask;
+	uint64_t tail = size - start < count ? size - start : count;
+	writeAll(fd, ring + start, tail * sizeof(traceRecord));
+	writeAll(fd, ring, (count - tail) * sizeof(traceRecord));
+	close(fd);
+}
+
+static void onFatal(int sig) {
+	writeRing();
+	raise(sig); //SA_RESETHAND put the default action back
+}
+
+static void onFlush(int sig) {
+	flushWanted = 1;
+}
+
+//records is rounded up to a power of two, at least a few keyframes' worth
+int startTrace(state8080 *state, const char *path, uint32_t records) {
+	uint64_t size = KEYFRAME_EVERY * 4;
+	while (size < records) size <<= 1;
+	ring = malloc(size * sizeof(traceRecord));
+	if (ring == NULL) {
+		printf("Error: no memory for a %llu record trace\n", (unsigned long long)size);
+		return 1;
+	}
+	ringMask = size - 1;
+	snprintf(tracePath, sizeof(tracePath), "%s", path);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = onFatal;
+	sa.sa_flags = SA_RESETHAND;
+	int fatal[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT, SIGINT, SIGTERM};
+	for (size_t i = 0; i < sizeof(fatal) / sizeof(fatal[0]); i++) sigaction(fatal[i], &sa, NULL);
+	sa.sa_handler = onFlush;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	keyframe(state, 0, 0);
+	traceOn = 1;
+	return 0;
+}
+
+//Starts the instruction's record; its write addresses come from the
+//registers before it runs
+void traceBefore(state8080 *state) {
+	before = *state;
+	memset(&pending, 0, sizeof(pending));
+	pending.pc = state->pc;
+	pending.op = state->memory[state->pc];
+	pending.operand[0] = state->memory[(uint16_t)(state->pc + 1)];
+	pending.operand[1] = state->memory[(uint16_t)(state->pc + 2)];
+
+	memAccess accesses[MAX_ACCESSES];
+	uint16_t writes[2];
+	int w = 0;
+	int n = decodeAccesses(state, accesses);
+	for (int i = 0; i < n && w < 2; i++) {
+		if (accesses[i].write && (w == 0 || accesses[i].addr != writes[0])) writes[w++] = accesses[i].addr;
+	}
+	//pairs are adjacent, listed either way round
+	pending.writeAddr = w == 2 && (uint16_t)(writes[1] + 1) == writes[0] ? writes[1] : writes[0];
+	pending.info = w << TRACE_WRITE_SHIFT;
+}
+
+void traceAfter(state8080 *state) {
+	traceRecord *r = &pending;
+	int n = 0;
+	uint8_t overflow = 0;
+	for (int i = 0; i < 7; i++) {
+		uint8_t now = ((uint8_t *)state)[regOffsets[i]];
+		if (now == ((uint8_t *)&before)[regOffsets[i]]) continue;
+		if (n == 4) {
+			overflow = 1;
+			break;
+		}
+		r->changed |= 1 << i;
+		r->vals[n++] = now;
+	}
+	if (state->sp != before.sp) {
+		if (n > 2) {
+			overflow = 1;
+		} else {
+			r->changed |= TRACE_SP;
+			r->vals[n++] = state->sp & 0xff;
+			r->vals[n++] = state->sp >> 8;
+		}
+	}
+	int w = (r->info & TRACE_WRITES) >> TRACE_WRITE_SHIFT;
+	for (int i = 0; i < w; i++) {
+		uint32_t addr = (uint16_t)(r->writeAddr + i);
+		r->writes[i] = addr < state->memSize ? state->memory[addr] : 0;
+	}
+	r->info |= packFlags(state);
+	*nextRecord() = pending;
+	if (overflow || (written & (KEYFRAME_EVERY - 1)) == 0) keyframe(state, 0, 0);
+	if (flushWanted) flushTrace();
+}
+
+//After a CP/M trap: the trap's changes go down as a keyframe
+void traceTrap(state8080 *state, uint16_t trapPc) {
+	keyframe(state, TRACE_TRAP, trapPc);
+}
+
+//State changed outside any instruction: registers set from the prompt
+//or gdb, memory poked, a checkpoint restored
+void traceResync(state8080 *state) {
+	if (traceOn) keyframe(state, 0, 0);
+}
+
+void flushTrace(void) {
+	flushWanted = 0;
+	if (ring != NULL) writeRing();
+}
+
+void stopTrace(void) {
+	if (!traceOn) return;
+	traceOn = 0;
+	writeRing();
+	free(ring);
+	ring = NULL;
+}
@@ -0,0 +1,60 @@
+//binary trace file: a traceHeader, then count 16-byte records
+#define TRACE_MAGIC "I8080TRC"
+#define TRACE_VERSION 1
+
+//info byte, shared by both record kinds
+#define TRACE_FLAGS 0x0f //z s p cy after the instruction
+#define TRACE_WRITES 0x30 //bytes written, 0-2
+#define TRACE_WRITE_SHIFT 4
+#define TRACE_KEYFRAME 0x40
+#define TRACE_TRAP 0x80 //keyframe after a CP/M trap
+
+//changed mask: which registers follow in vals, in this order
+#define TRACE_A 0x01
+#define TRACE_B 0x02
+#define TRACE_C 0x04
+#define TRACE_D 0x08
+#define TRACE_E 0x10
+#define TRACE_H 0x20
+#define TRACE_L 0x40
+#define TRACE_SP 0x80 //two bytes, low first
+
+typedef struct traceHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	uint64_t first; //records before this one were overwritten in the ring
+	uint64_t count;
+} traceHeader;
+
+typedef struct traceRecord {
+	uint16_t pc;
+	uint16_t writeAddr;
+	uint8_t info;
+	uint8_t op;
+	uint8_t operand[2];
+	uint8_t changed;
+	uint8_t vals[4];
+	uint8_t writes[2];
+	uint8_t spare;
+} traceRecord;
+
+//whole register file, before the instruction at pc
+typedef struct traceKeyframe {
+	uint16_t pc;
+	uint16_t sp;
+	uint8_t info;
+	uint8_t regs[7]; //A B C D E H L
+	uint16_t trapPc;
+	uint8_t spare[2];
+} traceKeyframe;
+
+extern uint8_t traceOn;
+
+int startTrace(state8080*, const char*, uint32_t);
+void traceBefore(state8080*);
+void traceAfter(state8080*);
+void traceTrap(state8080*, uint16_t);
+void traceResync(state8080*);
+void flushTrace(void);
+void stopTrace(void);
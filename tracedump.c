@@ -0,0 +1,121 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "disassembler.h"
+#include "trace.h"
+
+//Turns a -trace file back into text: each instruction's disassembly,
+//then what it changed. Registers are rebuilt by applying each record's
+//deltas to the last keyframe, so records ahead of the first keyframe
+//(where the ring wrapped) are skipped. disassemble() reads code from
+//memory, so the opcode and operand bytes are laid into a scratch 64K
+//image at each record's PC first.
+
+static const char *regNames[7] = {"A", "B", "C", "D", "E", "H", "L"};
+
+static void showFlags(uint8_t flags) {
+	printf("Z:%d S:%d P:%d CY:%d", flags & 1, (flags >> 1) & 1, (flags >> 2) & 1, (flags >> 3) & 1);
+}
+
+static void showState(const uint8_t *regs, uint16_t sp, uint16_t pc, uint8_t flags) {
+	printf("PC:$%04x SP:$%04x", pc, sp);
+	for (int i = 0; i < 7; i++) printf(" %s:$%02x", regNames[i], regs[i]);
+	printf("\t");
+	showFlags(flags);
+	printf("\n");
+}
+
+int main(int argc, char **argv) {
+	const char *path = NULL;
+	uint64_t last = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-last") == 0 && i + 1 < argc) {
+			last = strtoull(argv[++i], NULL, 0);
+		} else {
+			path = argv[i];
+		}
+	}
+	if (path == NULL) {
+		printf("usage: tracedump [-last n] trace\n");
+		return 1;
+	}
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		printf("Error: Couldn't open %s\n", path);
+		return 1;
+	}
+	traceHeader header;
+	if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, TRACE_MAGIC, 8) != 0
+			|| header.version != TRACE_VERSION || header.recordSize != sizeof(traceRecord)) {
+		printf("Error: %s isn't a version %d trace\n", path, TRACE_VERSION);
+		fclose(f);
+		return 1;
+	}
+	printf("%llu records from #%llu\n", (unsigned long long)header.count, (unsigned long long)header.first);
+
+	static unsigned char image[0x10002];
+	uint8_t regs[7] = {0};
+	uint16_t sp = 0;
+	uint8_t flags = 0;
+	uint8_t synced = 0;
+	uint64_t unsynced = 0;
+	uint64_t skip = last != 0 && header.count > last ? header.count - last : 0;
+	traceRecord r;
+	for (uint64_t i = 0; fread(&r, sizeof(r), 1, f) == 1; i++) {
+		if (r.info & TRACE_KEYFRAME) {
+			traceKeyframe *k = (traceKeyframe *)&r;
+			memcpy(regs, k->regs, sizeof(regs));
+			sp = k->sp;
+			flags = k->info & TRACE_FLAGS;
+			if (i >= skip && (!synced || (k->info & TRACE_TRAP))) {
+				if (k->info & TRACE_TRAP) printf("-- CP/M trap at $%04x\n", k->trapPc);
+				printf("-- ");
+				showState(regs, sp, k->pc, flags);
+			}
+			synced = 1;
+			continue;
+		}
+		if (!synced) {
+			unsynced++;
+			continue;
+		}
+		uint8_t changed[8] = {0};
+		int n = 0;
+		for (int bit = 0; bit < 7; bit++) {
+			if (r.changed & (1 << bit)) {
+				regs[bit] = r.vals[n++];
+				changed[bit] = 1;
+			}
+		}
+		if (r.changed & TRACE_SP) {
+			sp = r.vals[n] | (r.vals[n + 1] << 8);
+			changed[7] = 1;
+		}
+		uint8_t oldFlags = flags;
+		flags = r.info & TRACE_FLAGS;
+		if (i < skip) continue;
+
+		image[r.pc] = r.op;
+		image[r.pc + 1] = r.operand[0];
+		image[r.pc + 2] = r.operand[1];
+		disassemble((char *)image, r.pc);
+		int writes = (r.info & TRACE_WRITES) >> TRACE_WRITE_SHIFT;
+		if (r.changed == 0 && writes == 0 && flags == oldFlags) continue;
+		printf("\t\t");
+		for (int bit = 0; bit < 7; bit++) {
+			if (changed[bit]) printf("%s=$%02x ", regNames[bit], regs[bit]);
+		}
+		if (changed[7]) printf("SP=$%04x ", sp);
+		if (writes) {
+			printf("[$%04x]=", r.writeAddr);
+			for (int w = 0; w < writes; w++) printf("$%02x ", r.writes[w]);
+		}
+		if (flags != oldFlags) showFlags(flags);
+		printf("\n");
+	}
+	if (unsynced) printf("(%llu records before the first keyframe skipped)\n", (unsigned long long)unsynced);
+	fclose(f);
+	return 0;
+}
@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "globals.h"
+#include "console.h"
+#include "util.h"
 
 void invalidInstr(state8080*);
 
@@ -196,16 +198,39 @@ char* getRPLabel(state8080 *state, registerPair_kind rp) {
 
 void unimplementedInstr(state8080 *state) {
 	state->pc -= 1;
+	if (faultHandler != NULL) longjmp(*faultHandler, 1);
+	flushConsole();
 	printf("Error: Unimplemented instruction $%02x @ address $%04x\n", 
             state->memory[state->pc], state->pc);
-    free(state->memory);
     exit(1);
 }
 
 void invalidInstr(state8080 *state) {
     state->pc -= 1;
+    if (faultHandler != NULL) longjmp(*faultHandler, 1);
+    flushConsole();
     printf("Error: Invalid instruction $%02x @ address $%04x\n",
             state->memory[state->pc], state->pc);
-    free(state->memory);
     exit(1);
 }
+
+_Thread_local jmp_buf *faultHandler;
+
+const uint8_t opCycles[256] = {
+	4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,		//0x00
+	4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,		//0x10
+	4, 10, 16, 5, 5, 5, 7, 4, 4, 10, 16, 5, 5, 5, 7, 4,		//0x20
+	4, 10, 13, 5, 10, 10, 10, 4, 4, 10, 13, 5, 5, 5, 7, 4,	//0x30
+	5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,			//0x40
+	5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,			//0x50
+	5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,			//0x60
+	7, 7, 7, 7, 7, 7, 7, 7, 5, 5, 5, 5, 5, 5, 7, 5,			//0x70
+	4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,			//0x80
+	4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,			//0x90
+	4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,			//0xa0
+	4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,			//0xb0
+	11, 10, 10, 10, 17, 11, 7, 11, 11, 10, 10, 10, 17, 17, 7, 11,	//0xc0
+	11, 10, 10, 10, 17, 11, 7, 11, 11, 10, 10, 10, 17, 17, 7, 11,	//0xd0
+	11, 10, 10, 18, 17, 11, 7, 11, 11, 5, 10, 5, 17, 17, 7, 11,		//0xe0
+	11, 10, 10, 4, 17, 11, 7, 11, 11, 5, 10, 4, 17, 17, 7, 11,		//0xf0
+};
@@ -1,3 +1,5 @@
+#include <setjmp.h>
+
 //printing
 void printFlags(state8080*);
 void debugPrint(state8080*);
@@ -21,4 +23,9 @@ void setRPVal(state8080*, registerPair_kind, uint16_t);
 char* getRPLabel(state8080*, registerPair_kind);
 
 void unimplementedInstr(state8080*);
-void invalidInstr(state8080*);
\ No newline at end of file
+void invalidInstr(state8080*);
+//8080 clock cycles per opcode (taken branches/calls/returns use the long count)
+extern const uint8_t opCycles[256];
+
+//When set, bad instructions longjmp here instead of exiting (per thread)
+extern _Thread_local jmp_buf *faultHandler;